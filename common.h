@@ -60,6 +60,7 @@
 #include <linux/kthread.h>
 #include <linux/wait.h>
 #include <linux/time.h>
+#include <linux/ktime.h>
 
 #include <linux/namei.h>
 #include <linux/vmalloc.h>
@@ -235,9 +236,37 @@ enum ili9881_types {
 /* Either an interrupt event handled by kthread or work queue. */
 //#define USE_KTHREAD
 
+/*
+ * Handle an interrupt event inside the threaded irq handler directly.
+ * IRQF_ONESHOT keeps the line masked until the packet is handled, so it
+ * doesn't need to disable/enable irq by hand like kthread or work queue.
+ */
+//#define USE_IRQ_THREAD
+
+#if defined(USE_KTHREAD) && defined(USE_IRQ_THREAD)
+#error "USE_KTHREAD and USE_IRQ_THREAD can't be enabled at the same time"
+#endif
+
+/* The default RT priority of the thread handling interrupt events */
+#ifdef USE_KTHREAD
+#define IRQ_THREAD_PRIO		4
+#else
+#define IRQ_THREAD_PRIO		(MAX_USER_RT_PRIO / 2)
+#endif
+
 /* Enable DMA with I2C. */
 //#define I2C_DMA
 
+/*
+ * Flag long i2c messages as dma-safe so that any adapter can map them
+ * directly. It's replaced by I2C_DMA if MTK's extension is used.
+ */
+#define I2C_DMA_SAFE
+
+#if defined(I2C_DMA_SAFE) && (defined(I2C_DMA) || KERNEL_VERSION(4, 18, 0) > LINUX_VERSION_CODE)
+#undef I2C_DMA_SAFE
+#endif
+
 /* Split the length written to or read from IC via I2C. */
 //#define I2C_SEGMENT
 
@@ -252,6 +281,26 @@ enum ili9881_types {
 /* Check whether the IC is damaged by ESD */
 //#define ESD_CHECK
 
+/* Check the checksum against a bytewise sum by /proc/ilitek/checksum_bench */
+//#define CHECKSUM_BENCH
+
+/* Replay packets recorded from debug_message by /proc/ilitek/replay */
+//#define FR_REPLAY
+
+/* Collect latency of interrupt events, shown under /sys/kernel/debug/ilitek */
+#define LATENCY_STAT
+
+/* Build a software model of IC, used if "touch,bus" is "emu" in dts */
+//#define BUS_EMULATOR
+
+/* Stream mutual data at debug mode through a V4L2 touch device */
+#define TOUCH_V4L2
+
+#if defined(TOUCH_V4L2) && (!IS_ENABLED(CONFIG_VIDEO_V4L2) || !IS_ENABLED(CONFIG_VIDEOBUF2_VMALLOC) \
+	|| KERNEL_VERSION(4, 13, 0) > LINUX_VERSION_CODE)
+#undef TOUCH_V4L2
+#endif
+
 static inline void ipio_kfree(void **mem)
 {
 	if(*mem != NULL) {
@@ -203,13 +203,7 @@ uint32_t core_config_read_write_onebyte(uint32_t addr)
 	szOutBuf[2] = (char)((addr & 0x0000FF00) >> 8);
 	szOutBuf[3] = (char)((addr & 0x00FF0000) >> 16);
 
-	res = core_write(core_config->slave_i2c_addr, szOutBuf, 4);
-	if (res < 0)
-		goto out;
-
-	mdelay(1);
-
-	res = core_read(core_config->slave_i2c_addr, szOutBuf, 1);
+	res = core_write_read(core_config->slave_i2c_addr, szOutBuf, 4, szOutBuf, 1);
 	if (res < 0)
 		goto out;
 
@@ -234,13 +228,7 @@ uint32_t core_config_ice_mode_read(uint32_t addr)
 	szOutBuf[2] = (char)((addr & 0x0000FF00) >> 8);
 	szOutBuf[3] = (char)((addr & 0x00FF0000) >> 16);
 
-	res = core_write(core_config->slave_i2c_addr, szOutBuf, 4);
-	if (res < 0)
-		goto out;
-
-	mdelay(10);
-
-	res = core_read(core_config->slave_i2c_addr, szOutBuf, 4);
+	res = core_write_read(core_config->slave_i2c_addr, szOutBuf, 4, szOutBuf, 4);
 	if (res < 0)
 		goto out;
 
@@ -281,6 +269,124 @@ int core_config_ice_mode_write(uint32_t addr, uint32_t data, uint32_t size)
 }
 EXPORT_SYMBOL(core_config_ice_mode_write);
 
+void core_config_ice_queue_init(struct core_ice_queue *q)
+{
+	q->num = 0;
+	q->err = 0;
+}
+EXPORT_SYMBOL(core_config_ice_queue_init);
+
+static struct core_ice_op *ice_queue_next(struct core_ice_queue *q)
+{
+	if (q->num >= ICE_QUEUE_MAX_OPS) {
+		ipio_err("ICE queue is full (%d)\n", q->num);
+		q->err = -ENOSPC;
+		return NULL;
+	}
+
+	return &q->op[q->num++];
+}
+
+static void ice_queue_set_addr(struct core_ice_op *op, uint32_t addr)
+{
+	op->cmd[0] = 0x25;
+	op->cmd[1] = (char)((addr & 0x000000FF) >> 0);
+	op->cmd[2] = (char)((addr & 0x0000FF00) >> 8);
+	op->cmd[3] = (char)((addr & 0x00FF0000) >> 16);
+}
+
+void core_config_ice_queue_write(struct core_ice_queue *q, uint32_t addr, uint32_t data, uint32_t size)
+{
+	int i;
+	struct core_ice_op *op = NULL;
+
+	/* cmd only has room for 4 bytes of data after the address */
+	if (size > sizeof(op->cmd) - 4) {
+		ipio_err("ICE write of %d bytes is too long\n", size);
+		q->err = -EINVAL;
+		return;
+	}
+
+	op = ice_queue_next(q);
+	if (op == NULL)
+		return;
+
+	ice_queue_set_addr(op, addr);
+	for (i = 0; i < size; i++)
+		op->cmd[i + 4] = (char)(data >> (8 * i));
+
+	op->buf = op->cmd;
+	op->len = size + 4;
+	op->rlen = 0;
+}
+EXPORT_SYMBOL(core_config_ice_queue_write);
+
+/* buf must lead with 0x25 and the address, and stay valid until submitted */
+void core_config_ice_queue_write_buf(struct core_ice_queue *q, uint8_t *buf, uint16_t len)
+{
+	struct core_ice_op *op = ice_queue_next(q);
+
+	if (op == NULL)
+		return;
+
+	op->buf = buf;
+	op->len = len;
+	op->rlen = 0;
+}
+EXPORT_SYMBOL(core_config_ice_queue_write_buf);
+
+void core_config_ice_queue_read(struct core_ice_queue *q, uint32_t addr, uint32_t size)
+{
+	struct core_ice_op *op = ice_queue_next(q);
+
+	if (op == NULL)
+		return;
+
+	ice_queue_set_addr(op, addr);
+	op->buf = op->cmd;
+	op->len = 4;
+	op->rlen = min_t(uint32_t, size, sizeof(op->rbuf));
+	memset(op->rbuf, 0x0, sizeof(op->rbuf));
+}
+EXPORT_SYMBOL(core_config_ice_queue_read);
+
+/*
+ * Submit all of queued R/W as one transfer. The queue is emptied and can be
+ * reused, while rdata holds values read back until the next submit.
+ */
+int core_config_ice_queue_submit(struct core_ice_queue *q)
+{
+	int i, j, res = 0;
+	struct core_ice_op *op = NULL;
+
+	if (q->err < 0) {
+		res = q->err;
+		goto out;
+	}
+
+	if (q->num == 0)
+		goto out;
+
+	res = core_bus->ice_transfer(q);
+	if (res < 0) {
+		ipio_err("Failed to submit ICE queue (%d ops), res = %d\n", q->num, res);
+		goto out;
+	}
+
+	for (i = 0, j = 0; i < q->num; i++) {
+		op = &q->op[i];
+		if (op->rlen == 0)
+			continue;
+
+		q->rdata[j++] = op->rbuf[0] + (op->rbuf[1] << 8) + (op->rbuf[2] << 16) + (op->rbuf[3] << 24);
+	}
+
+out:
+	core_config_ice_queue_init(q);
+	return res;
+}
+EXPORT_SYMBOL(core_config_ice_queue_submit);
+
 /*
  * Doing soft reset on ic.
  *
@@ -702,8 +808,7 @@ int core_config_check_cdc_busy(int conut, int delay)
 
 	while (timer > 0) {
 		core_write(core_config->slave_i2c_addr, cmd, 2);
-		core_write(core_config->slave_i2c_addr, &cmd[1], 1);
-		core_read(core_config->slave_i2c_addr, &busy, 1);
+		core_write_read(core_config->slave_i2c_addr, &cmd[1], 1, &busy, 1);
 
 		ipio_debug(DEBUG_CONFIG, "busy status = 0x%x\n", busy);
 
@@ -810,19 +915,11 @@ int core_config_get_key_info(void)
 		goto out;
 	}
 
-	mdelay(1);
+	core_protocol_turnaround(cmd[0]);
 
-	res = core_write(core_config->slave_i2c_addr, &cmd[1], 1);
+	res = core_write_read(core_config->slave_i2c_addr, &cmd[1], 1, &g_read_buf[0], protocol->key_info_len);
 	if (res < 0) {
-		ipio_err("Failed to write data via I2C, %d\n", res);
-		goto out;
-	}
-
-	mdelay(1);
-
-	res = core_read(core_config->slave_i2c_addr, &g_read_buf[0], protocol->key_info_len);
-	if (res < 0) {
-		ipio_err("Failed to read data via I2C, %d\n", res);
+		ipio_err("Failed to write/read data via I2C, %d\n", res);
 		goto out;
 	}
 
@@ -866,19 +963,11 @@ int core_config_get_tp_info(void)
 		goto out;
 	}
 
-	mdelay(1);
-
-	res = core_write(core_config->slave_i2c_addr, &cmd[1], 1);
-	if (res < 0) {
-		ipio_err("Failed to write data via I2C, %d\n", res);
-		goto out;
-	}
-
-	mdelay(1);
+	core_protocol_turnaround(cmd[0]);
 
-	res = core_read(core_config->slave_i2c_addr, &g_read_buf[0], protocol->tp_info_len);
+	res = core_write_read(core_config->slave_i2c_addr, &cmd[1], 1, &g_read_buf[0], protocol->tp_info_len);
 	if (res < 0) {
-		ipio_err("Failed to read data via I2C, %d\n", res);
+		ipio_err("Failed to write/read data via I2C, %d\n", res);
 		goto out;
 	}
 
@@ -920,6 +1009,10 @@ int core_config_get_tp_info(void)
 	core_config->tp_info->nKeyCount = 0;
 /* huaqin modify for ZQL1830-1529 by liufurong at 20181101 end */
 
+	/* The length of packets depends on tp info */
+	if (core_fr != NULL)
+		res = core_fr_update_len_table();
+
 out:
 	return res;
 }
@@ -943,19 +1036,11 @@ int core_config_get_protocol_ver(void)
 		goto out;
 	}
 
-	mdelay(1);
-
-	res = core_write(core_config->slave_i2c_addr, &cmd[1], 1);
-	if (res < 0) {
-		ipio_err("Failed to write data via I2C, %d\n", res);
-		goto out;
-	}
-
-	mdelay(1);
+	core_protocol_turnaround(cmd[0]);
 
-	res = core_read(core_config->slave_i2c_addr, &g_read_buf[0], protocol->pro_ver_len);
+	res = core_write_read(core_config->slave_i2c_addr, &cmd[1], 1, &g_read_buf[0], protocol->pro_ver_len);
 	if (res < 0) {
-		ipio_err("Failed to read data via I2C, %d\n", res);
+		ipio_err("Failed to write/read data via I2C, %d\n", res);
 		goto out;
 	}
 
@@ -981,6 +1066,8 @@ int core_config_get_protocol_ver(void)
 		res = core_protocol_update_ver(major, mid, minor);
 		if (res < 0)
 			ipio_err("Protocol version is invalid\n");
+		else if (core_fr != NULL)
+			res = core_fr_update_len_table();
 	}
 
 out:
@@ -1004,19 +1091,11 @@ int core_config_get_core_ver(void)
 		goto out;
 	}
 
-	mdelay(1);
+	core_protocol_turnaround(cmd[0]);
 
-	res = core_write(core_config->slave_i2c_addr, &cmd[1], 1);
+	res = core_write_read(core_config->slave_i2c_addr, &cmd[1], 1, &g_read_buf[0], protocol->core_ver_len);
 	if (res < 0) {
-		ipio_err("Failed to write data via I2C, %d\n", res);
-		goto out;
-	}
-
-	mdelay(1);
-
-	res = core_read(core_config->slave_i2c_addr, &g_read_buf[0], protocol->core_ver_len);
-	if (res < 0) {
-		ipio_err("Failed to read data via I2C, %d\n", res);
+		ipio_err("Failed to write/read data via I2C, %d\n", res);
 		goto out;
 	}
 
@@ -1053,17 +1132,9 @@ int core_config_get_fw_ver(void)
 		goto out;
 	}
 
-	mdelay(1);
-
-	res = core_write(core_config->slave_i2c_addr, &cmd[1], 1);
-	if (res < 0) {
-		ipio_err("Failed to write data via I2C, %d\n", res);
-		goto out;
-	}
-
-	mdelay(1);
+	core_protocol_turnaround(cmd[0]);
 
-	res = core_read(core_config->slave_i2c_addr, &g_read_buf[0], protocol->fw_ver_len);
+	res = core_write_read(core_config->slave_i2c_addr, &cmd[1], 1, &g_read_buf[0], protocol->fw_ver_len);
 	if (res < 0) {
 		ipio_err("Failed to read fw version %d\n", res);
 		goto out;
@@ -85,6 +85,28 @@ struct core_config_data {
 
 extern struct core_config_data *core_config;
 
+/* The max number of register R/W queued in ICE mode before being submitted */
+#define ICE_QUEUE_MAX_OPS	16
+
+struct core_ice_op {
+	uint8_t cmd[8];
+	uint8_t *buf;
+	uint16_t len;
+	uint8_t rlen;
+	uint8_t rbuf[4];
+};
+
+/*
+ * Register R/W in ICE mode recorded in order, then submitted to the bus as
+ * one transfer. Values read back are filled in rdata by the order of reads.
+ */
+struct core_ice_queue {
+	int num;
+	int err;
+	struct core_ice_op op[ICE_QUEUE_MAX_OPS];
+	uint32_t rdata[ICE_QUEUE_MAX_OPS];
+};
+
 extern int fw_cmd_len;
 extern int protocol_cmd_len;
 extern int tp_info_len;
@@ -97,6 +119,11 @@ extern int core_config_ice_mode_write(uint32_t addr, uint32_t data, uint32_t siz
 extern uint32_t core_config_read_write_onebyte(uint32_t addr);
 extern int core_config_ice_mode_disable(void);
 extern int core_config_ice_mode_enable(void);
+extern void core_config_ice_queue_init(struct core_ice_queue *q);
+extern void core_config_ice_queue_write(struct core_ice_queue *q, uint32_t addr, uint32_t data, uint32_t size);
+extern void core_config_ice_queue_write_buf(struct core_ice_queue *q, uint8_t *buf, uint16_t len);
+extern void core_config_ice_queue_read(struct core_ice_queue *q, uint32_t addr, uint32_t size);
+extern int core_config_ice_queue_submit(struct core_ice_queue *q);
 
 /* Touch IC status */
 extern int core_config_set_watch_dog(bool enable);
@@ -0,0 +1,564 @@
+/*
+ * ILITEK Touch IC driver
+ *
+ * Copyright (C) 2011 ILI Technology Corporation.
+ *
+ * Author: Dicky Chiang <dicky_chiang@ilitek.com>
+ * Based on TDD v7.0 implemented by Mstar & ILITEK
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
+
+#include "../common.h"
+#include "../platform.h"
+#include "config.h"
+#include "protocol.h"
+#include "finger_report.h"
+#include "emu.h"
+
+#ifdef BUS_EMULATOR
+
+/*
+ * A software model of ILI9881H behind struct core_bus_ops. It answers ICE
+ * registers used by the driver, keeps a spi flash (W25Q20EW) behind the
+ * flash controller, replies the commands of panel information and makes
+ * demo packets of one finger drawing a diagonal line, so the driver can be
+ * run without a panel.
+ */
+#define EMU_PID			((CHIP_TYPE_ILI9881 << 16) | (ILI9881_TYPE_H << 8) | CORE_TYPE_B)
+#define EMU_FLASH_MID		0xEF
+#define EMU_FLASH_DID		0x6012
+#define EMU_FLASH_SIZE		(256 * 1024)
+#define EMU_SECTOR_SIZE		(4 * 1024)
+
+#define EMU_X_CH		18
+#define EMU_Y_CH		32
+#define EMU_RATE_MAX		1000
+
+/* A finger stays down for EMU_STROKE_FRAMES, then is lifted for EMU_LIFT_FRAMES */
+#define EMU_STROKE_FRAMES	120
+#define EMU_LIFT_FRAMES		10
+
+/* ICE registers */
+#define EMU_REG_CS		0x041000
+#define EMU_REG_FLASH_TX	0x041008
+#define EMU_REG_RX_COUNT	0x04100C
+#define EMU_REG_FLASH_RX	0x041010
+#define EMU_REG_CSUM_F		0x041014
+#define EMU_REG_CHECKSUM	0x041018
+#define EMU_REG_CRC		0x04101C
+#define EMU_REG_CSUM_H		0x048007
+#define EMU_REG_IC_RESET	0x040050
+#define EMU_REG_WDT_STATUS	0x051018
+
+/* Other registers just keep what was written */
+#define EMU_REG_NUM		32
+
+enum {
+	EMU_READ_PACKET = 0,
+	EMU_READ_REG,
+	EMU_READ_CMD,
+};
+
+struct emu_reg {
+	uint32_t addr;
+	uint32_t val;
+};
+
+struct core_emu_data {
+	struct mutex lock;
+
+	/* what the next read gives back */
+	int rsrc;
+	uint32_t raddr;
+	uint8_t cmd;
+	uint8_t mode;
+
+	/* spi flash and the controller in front of it */
+	uint8_t *flash;
+	bool cs;
+	bool wel;
+	uint8_t fcmd;
+	int fpos;
+	uint32_t faddr;
+	uint8_t frx;
+	uint32_t rx_count;
+	uint32_t checksum;
+	uint32_t crc;
+	bool csum_done;
+
+	struct emu_reg reg[EMU_REG_NUM];
+	int reg_num;
+
+	struct delayed_work touch_work;
+	struct core_emu_stat stat;
+};
+
+static struct core_emu_data *core_emu = NULL;
+
+static void emu_reg_set(uint32_t addr, uint32_t val)
+{
+	int i;
+
+	for (i = 0; i < core_emu->reg_num; i++) {
+		if (core_emu->reg[i].addr == addr)
+			break;
+	}
+
+	if (i == EMU_REG_NUM) {
+		ipio_debug(DEBUG_CONFIG, "emu: register file is full, drop 0x%x\n", addr);
+		return;
+	}
+
+	if (i == core_emu->reg_num)
+		core_emu->reg_num++;
+
+	core_emu->reg[i].addr = addr;
+	core_emu->reg[i].val = val;
+}
+
+static uint32_t emu_reg_get(uint32_t addr)
+{
+	int i;
+
+	for (i = 0; i < core_emu->reg_num; i++) {
+		if (core_emu->reg[i].addr == addr)
+			return core_emu->reg[i].val;
+	}
+
+	return 0;
+}
+
+/* The same CRC as firmware.c calculates from the hex file */
+static uint32_t emu_crc32(const uint8_t *data, uint32_t len)
+{
+	int i, j;
+	uint32_t crc = 0xFFFFFFFF;
+
+	for (i = 0; i < len; i++) {
+		crc ^= (data[i] << 24);
+
+		for (j = 0; j < 8; j++) {
+			if ((crc & 0x80000000) != 0)
+				crc = crc << 1 ^ 0x04C11DB7;
+			else
+				crc = crc << 1;
+		}
+	}
+
+	return crc;
+}
+
+static void emu_flash_checksum(void)
+{
+	int i;
+	uint32_t start = core_emu->faddr % EMU_FLASH_SIZE;
+	uint32_t len = min_t(uint32_t, core_emu->rx_count, EMU_FLASH_SIZE - start);
+
+	core_emu->checksum = 0;
+	for (i = 0; i < len; i++)
+		core_emu->checksum += core_emu->flash[start + i];
+
+	core_emu->crc = emu_crc32(core_emu->flash + start, len);
+	core_emu->csum_done = true;
+}
+
+static void emu_flash_cs(bool high)
+{
+	/* a command is executed when CS goes high */
+	if (high && core_emu->cs) {
+		if (core_emu->fcmd == 0x20 && core_emu->fpos > 3 && core_emu->wel) {
+			memset(core_emu->flash + ((core_emu->faddr % EMU_FLASH_SIZE) & ~(EMU_SECTOR_SIZE - 1)),
+				0xFF, EMU_SECTOR_SIZE);
+		}
+
+		if (core_emu->fcmd == 0x02 || core_emu->fcmd == 0x20)
+			core_emu->wel = false;
+	}
+
+	core_emu->cs = !high;
+	core_emu->fpos = 0;
+}
+
+static void emu_flash_tx(uint8_t b)
+{
+	uint8_t id[] = {EMU_FLASH_MID, EMU_FLASH_DID >> 8, EMU_FLASH_DID & 0xFF, 0xFF};
+
+	if (!core_emu->cs)
+		return;
+
+	if (core_emu->fpos == 0) {
+		core_emu->fcmd = b;
+		core_emu->faddr = 0;
+		core_emu->fpos = 1;
+
+		if (b == 0x06)
+			core_emu->wel = true;
+		return;
+	}
+
+	switch (core_emu->fcmd) {
+	case 0x9F:
+		core_emu->frx = id[min_t(int, core_emu->fpos - 1, ARRAY_SIZE(id) - 1)];
+		core_emu->fpos++;
+		break;
+	case 0x05:
+		/* program and erase are done at once, so it's never busy */
+		core_emu->frx = 0x0;
+		break;
+	case 0x02:
+	case 0x03:
+	case 0x20:
+	case 0x3b:
+		if (core_emu->fpos <= 3) {
+			core_emu->faddr = (core_emu->faddr << 8) | b;
+			core_emu->fpos++;
+			break;
+		}
+
+		if (core_emu->fcmd == 0x02 && core_emu->wel)
+			core_emu->flash[core_emu->faddr++ % EMU_FLASH_SIZE] &= b;
+		else if (core_emu->fcmd == 0x03)
+			core_emu->frx = core_emu->flash[core_emu->faddr++ % EMU_FLASH_SIZE];
+		break;
+	default:
+		break;
+	}
+}
+
+static void emu_reset(void)
+{
+	core_emu->mode = protocol->demo_mode;
+	core_emu->rsrc = EMU_READ_PACKET;
+	core_emu->cs = false;
+	core_emu->wel = false;
+}
+
+static void emu_ice_write(uint32_t addr, uint8_t *data, int len)
+{
+	int i;
+	uint32_t val = 0;
+
+	for (i = 0; i < len && i < 4; i++)
+		val |= data[i] << (8 * i);
+
+	switch (addr) {
+	case EMU_REG_CS:
+		emu_flash_cs(val & 0x1);
+		break;
+	case EMU_REG_FLASH_TX:
+		for (i = 0; i < len; i++)
+			emu_flash_tx(data[i]);
+		break;
+	case EMU_REG_RX_COUNT:
+		core_emu->rx_count = val;
+		break;
+	case EMU_REG_FLASH_RX:
+		if (len > 0 && core_emu->fcmd == 0x3b)
+			emu_flash_checksum();
+		break;
+	case EMU_REG_CSUM_F:
+	case EMU_REG_CSUM_H:
+		core_emu->csum_done = false;
+		break;
+	case ILI9881_WDT_ADDR:
+		emu_reg_set(EMU_REG_WDT_STATUS, (val == 0x1) ? 0xA5 : 0x5A);
+		break;
+	case EMU_REG_IC_RESET:
+		emu_reset();
+		break;
+	default:
+		emu_reg_set(addr, val);
+		break;
+	}
+}
+
+static uint32_t emu_ice_read(uint32_t addr)
+{
+	switch (addr) {
+	case ILI9881_PID_ADDR:
+		return EMU_PID;
+	case EMU_REG_FLASH_RX:
+		return core_emu->frx;
+	case EMU_REG_CSUM_F:
+		return core_emu->csum_done;
+	case EMU_REG_CSUM_H:
+		return core_emu->csum_done << 1;
+	case EMU_REG_CHECKSUM:
+		return core_emu->checksum;
+	case EMU_REG_CRC:
+		return core_emu->crc;
+	default:
+		return emu_reg_get(addr);
+	}
+}
+
+static void emu_cmd_reply(uint8_t *buf, uint16_t len)
+{
+	uint8_t resp[32] = { 0 };
+	uint8_t cmd = core_emu->cmd;
+
+	resp[0] = cmd;
+
+	if (cmd == protocol->cmd_get_tp_info) {
+		resp[3] = TOUCH_SCREEN_X_MAX & 0xFF;
+		resp[4] = TOUCH_SCREEN_X_MAX >> 8;
+		resp[5] = TOUCH_SCREEN_Y_MAX & 0xFF;
+		resp[6] = TOUCH_SCREEN_Y_MAX >> 8;
+		resp[7] = EMU_X_CH;
+		resp[8] = EMU_Y_CH;
+		resp[9] = MAX_TOUCH_NUM;
+		resp[11] = EMU_X_CH;
+		resp[12] = EMU_Y_CH;
+	} else if (cmd == protocol->cmd_get_pro_ver) {
+		resp[1] = PROTOCOL_MAJOR;
+		resp[2] = PROTOCOL_MID;
+		resp[3] = PROTOCOL_MINOR;
+	} else if (cmd == protocol->cmd_get_fw_ver || cmd == protocol->cmd_get_core_ver) {
+		resp[1] = 0x1;
+	} else if (cmd == protocol->cmd_cdc_busy) {
+		resp[0] = (core_emu->mode == protocol->test_mode) ? 0x51 : 0x41;
+	}
+
+	memset(buf, 0x0, len);
+	memcpy(buf, resp, min_t(uint16_t, len, sizeof(resp)));
+}
+
+static void emu_packet(uint8_t *buf, uint16_t len)
+{
+	uint32_t phase, x, y;
+
+	/* Only demo packets are modeled, and pid 0 is ignored by the parser */
+	if (core_emu->mode != protocol->demo_mode || len < 6) {
+		memset(buf, 0x0, len);
+		return;
+	}
+
+	memset(buf, 0xFF, len);
+	buf[0] = protocol->demo_pid;
+
+	phase = core_emu->stat.frames % (EMU_STROKE_FRAMES + EMU_LIFT_FRAMES);
+	if (phase < EMU_STROKE_FRAMES) {
+		x = phase * (TOUCH_SCREEN_X_MAX - 1) / (EMU_STROKE_FRAMES - 1);
+		y = phase * (TOUCH_SCREEN_Y_MAX - 1) / (EMU_STROKE_FRAMES - 1);
+
+		buf[1] = ((x & 0xF00) >> 4) | ((y & 0xF00) >> 8);
+		buf[2] = x & 0xFF;
+		buf[3] = y & 0xFF;
+		buf[4] = 0x1;
+	}
+
+	buf[len - 1] = core_fr_calc_checksum(buf, len - 1);
+}
+
+static int emu_write(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
+{
+	uint32_t addr;
+
+	if (nSize == 0)
+		return 0;
+
+	mutex_lock(&core_emu->lock);
+	core_emu->stat.writes++;
+
+	if (pBuf[0] == 0x25 && nSize >= 4) {
+		addr = pBuf[1] | (pBuf[2] << 8) | (pBuf[3] << 16);
+
+		/* Only the address is given if it's going to be read */
+		if (nSize == 4) {
+			core_emu->raddr = addr;
+			core_emu->rsrc = EMU_READ_REG;
+		} else {
+			emu_ice_write(addr, pBuf + 4, nSize - 4);
+		}
+	} else if (pBuf[0] == protocol->cmd_mode_ctrl) {
+		if (nSize > 1)
+			core_emu->mode = pBuf[1];
+		core_emu->rsrc = EMU_READ_PACKET;
+	} else if (pBuf[0] == protocol->cmd_get_tp_info || pBuf[0] == protocol->cmd_get_key_info ||
+		pBuf[0] == protocol->cmd_get_fw_ver || pBuf[0] == protocol->cmd_get_pro_ver ||
+		pBuf[0] == protocol->cmd_get_core_ver || pBuf[0] == protocol->cmd_cdc_busy) {
+		core_emu->cmd = pBuf[0];
+		core_emu->rsrc = EMU_READ_CMD;
+	}
+
+	mutex_unlock(&core_emu->lock);
+	return 0;
+}
+
+static int emu_read(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
+{
+	int i;
+	uint32_t val;
+
+	mutex_lock(&core_emu->lock);
+	core_emu->stat.reads++;
+
+	switch (core_emu->rsrc) {
+	case EMU_READ_REG:
+		val = emu_ice_read(core_emu->raddr);
+		memset(pBuf, 0x0, nSize);
+		for (i = 0; i < nSize && i < 4; i++)
+			pBuf[i] = (val >> (8 * i)) & 0xFF;
+		break;
+	case EMU_READ_CMD:
+		emu_cmd_reply(pBuf, nSize);
+		break;
+	default:
+		emu_packet(pBuf, nSize);
+		break;
+	}
+
+	core_emu->rsrc = EMU_READ_PACKET;
+	mutex_unlock(&core_emu->lock);
+	return 0;
+}
+
+static int emu_write_read(uint8_t nSlaveId, uint8_t *wbuf, uint16_t wsize, uint8_t *rbuf, uint16_t rsize)
+{
+	emu_write(nSlaveId, wbuf, wsize);
+	return emu_read(nSlaveId, rbuf, rsize);
+}
+
+static int emu_ice_transfer(struct core_ice_queue *q)
+{
+	int i;
+	struct core_ice_op *op = NULL;
+
+	for (i = 0; i < q->num; i++) {
+		op = &q->op[i];
+		if (op->rlen)
+			emu_write_read(0, op->buf, op->len, op->rbuf, op->rlen);
+		else
+			emu_write(0, op->buf, op->len);
+	}
+
+	return 0;
+}
+
+/* Raise an "interrupt" for each frame as long as the rate is set */
+static void emu_touch_work(struct work_struct *work)
+{
+	uint32_t rate_hz = READ_ONCE(core_emu->stat.rate_hz);
+
+	if (rate_hz == 0)
+		return;
+
+	mutex_lock(&core_emu->lock);
+	core_emu->stat.frames++;
+	mutex_unlock(&core_emu->lock);
+
+	core_fr_handler();
+
+	schedule_delayed_work(&core_emu->touch_work, msecs_to_jiffies(MSEC_PER_SEC / rate_hz));
+}
+
+static int emu_init(void)
+{
+	if (core_emu != NULL)
+		return 0;
+
+	core_emu = devm_kzalloc(ipd->dev, sizeof(*core_emu), GFP_KERNEL);
+	if (ERR_ALLOC_MEM(core_emu)) {
+		ipio_err("Failed to allocate core_emu mem, %ld\n", PTR_ERR(core_emu));
+		core_emu = NULL;
+		return -ENOMEM;
+	}
+
+	core_emu->flash = vmalloc(EMU_FLASH_SIZE);
+	if (ERR_ALLOC_MEM(core_emu->flash)) {
+		ipio_err("Failed to allocate emulated flash\n");
+		devm_kfree(ipd->dev, core_emu);
+		core_emu = NULL;
+		return -ENOMEM;
+	}
+
+	memset(core_emu->flash, 0xFF, EMU_FLASH_SIZE);
+	mutex_init(&core_emu->lock);
+	INIT_DELAYED_WORK(&core_emu->touch_work, emu_touch_work);
+	emu_reset();
+
+	ipio_info("Emulated IC: pid = 0x%x, flash = %dK\n", EMU_PID, EMU_FLASH_SIZE / 1024);
+	return 0;
+}
+
+struct core_bus_ops core_emu_bus_ops = {
+	.name = "emu",
+	.init = emu_init,
+	.write = emu_write,
+	.read = emu_read,
+	.write_read = emu_write_read,
+	.ice_transfer = emu_ice_transfer,
+	.no_irq = true,
+};
+EXPORT_SYMBOL(core_emu_bus_ops);
+
+/*
+ * Set how many frames the emulated IC reports per second, and 0 stops it.
+ * The rate is limited by jiffies as the frame is driven by a delayed work.
+ */
+int core_emu_set_rate(uint32_t rate_hz)
+{
+	if (core_emu == NULL || core_bus != &core_emu_bus_ops) {
+		ipio_err("Emulated IC isn't in use\n");
+		return -ENODEV;
+	}
+
+	if (rate_hz > EMU_RATE_MAX) {
+		ipio_err("Rate (%d) is over %d Hz\n", rate_hz, EMU_RATE_MAX);
+		return -EINVAL;
+	}
+
+	cancel_delayed_work_sync(&core_emu->touch_work);
+	WRITE_ONCE(core_emu->stat.rate_hz, rate_hz);
+
+	if (rate_hz)
+		schedule_delayed_work(&core_emu->touch_work, 0);
+
+	ipio_info("Emulated IC reports at %d Hz\n", rate_hz);
+	return 0;
+}
+EXPORT_SYMBOL(core_emu_set_rate);
+
+void core_emu_get_stat(struct core_emu_stat *stat)
+{
+	memset(stat, 0x0, sizeof(*stat));
+
+	if (core_emu == NULL)
+		return;
+
+	mutex_lock(&core_emu->lock);
+	*stat = core_emu->stat;
+	mutex_unlock(&core_emu->lock);
+}
+EXPORT_SYMBOL(core_emu_get_stat);
+
+void core_emu_remove(void)
+{
+	if (core_emu == NULL)
+		return;
+
+	WRITE_ONCE(core_emu->stat.rate_hz, 0);
+	cancel_delayed_work_sync(&core_emu->touch_work);
+	vfree(core_emu->flash);
+	core_emu->flash = NULL;
+}
+EXPORT_SYMBOL(core_emu_remove);
+
+#endif /* BUS_EMULATOR */
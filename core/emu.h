@@ -0,0 +1,47 @@
+/*
+ * ILITEK Touch IC driver
+ *
+ * Copyright (C) 2011 ILI Technology Corporation.
+ *
+ * Author: Dicky Chiang <dicky_chiang@ilitek.com>
+ * Based on TDD v7.0 implemented by Mstar & ILITEK
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef __EMU_H
+#define __EMU_H
+
+struct core_emu_stat {
+	uint32_t rate_hz;
+	uint32_t frames;
+	uint32_t writes;
+	uint32_t reads;
+};
+
+#ifdef BUS_EMULATOR
+extern struct core_bus_ops core_emu_bus_ops;
+
+extern int core_emu_set_rate(uint32_t rate_hz);
+extern void core_emu_get_stat(struct core_emu_stat *stat);
+extern void core_emu_remove(void);
+#else
+static inline int core_emu_set_rate(uint32_t rate_hz) { return -ENODEV; }
+static inline void core_emu_get_stat(struct core_emu_stat *stat) {}
+static inline void core_emu_remove(void) {}
+#endif /* BUS_EMULATOR */
+
+#endif
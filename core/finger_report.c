@@ -29,6 +29,9 @@
 #include <linux/input/mt.h>
 #include <linux/i2c.h>
 #include <linux/list.h>
+#include <linux/random.h>
+#include <linux/hrtimer.h>
+#include <asm/unaligned.h>
 
 #include "../common.h"
 #include "../platform.h"
@@ -38,6 +41,8 @@
 #include "gesture.h"
 #include "mp_test.h"
 #include "protocol.h"
+#include "latency.h"
+#include "heatmap.h"
 
 /* An id with position in each fingers */
 struct mutual_touch_point {
@@ -60,17 +65,193 @@ struct fr_data_node {
 	uint16_t len;
 };
 
-/* record the status of touch being pressed or released currently and previosuly */
-uint8_t g_current_touch[MAX_TOUCH_NUM];
-uint8_t g_previous_touch[MAX_TOUCH_NUM];
+/*
+ * Buffers reused by every finger report packet, so that the interrupt path
+ * never has to allocate memory. It is sized at probe and grown whenever
+ * the firmware mode or tp info changes the length of packet.
+ */
+struct fr_frame_pool {
+	struct mutex lock;
+	struct fr_data_node node;
+	/* the packet read from firmware, followed by the rest of i2cuart data */
+	uint8_t *frame;
+	uint16_t size;
+};
+
+/* 2048 is referred to the defination by user */
+#define FR_USER_FRAME_SIZE	2048
+
+/* record the status of touch being pressed or released currently and previosuly, a bit per slot */
+unsigned long g_current_touch;
+unsigned long g_previous_touch;
+
+/* the last point reported on each slot, used to drop events that don't change anything */
+struct mutual_touch_point g_last_point[MAX_TOUCH_NUM];
+
+/*
+ * Coalescing of frames under sustained touch. While fingers only move,
+ * frames coming in less than cadence_us after the last report are merged
+ * into one pending frame, which is reported at the deadline by a timer or
+ * earlier by vsync. Fingers pressed or released are reported at once.
+ */
+struct fr_coalesce {
+	uint32_t cadence_us;
+	ktime_t last_report;
+	bool pending;
+	unsigned long pending_touch;
+	struct mutual_touch_info pending_data;
+	struct hrtimer timer;
+	struct work_struct flush;
+	struct core_fr_coalesce_stat stat;
+};
+
+static struct fr_coalesce g_fr_coalesce;
+
+/*
+ * Constant velocity prediction per slot, all in fixed point. Velocity is
+ * in 16.16 pixels per us, smoothed by a first order filter, and points are
+ * moved forward by horizon_us. Each prediction is kept until a sample at
+ * or after its time comes, to measure how far it was from the real one.
+ */
+#define PREDICT_HORIZON_MAX_MS	50
+#define PREDICT_GAP_US		50000
+#define PREDICT_SMOOTH_SHIFT	1
+#define PREDICT_HISTORY		8
+
+struct fr_predict_point {
+	int64_t target_ns;
+	int32_t x;
+	int32_t y;
+};
+
+struct fr_predict_slot {
+	bool valid;
+	int64_t last_ns;
+	int32_t x;
+	int32_t y;
+	int32_t vx;
+	int32_t vy;
+	struct fr_predict_point pending[PREDICT_HISTORY];
+	uint8_t head;
+	uint8_t num;
+};
+
+struct fr_predict {
+	uint32_t horizon_us;
+	struct fr_predict_slot slot[MAX_TOUCH_NUM];
+	struct core_fr_predict_stat stat;
+};
+
+static struct fr_predict g_fr_predict;
+
+/* input events sent so far, also counted while replaying packets */
+static struct core_fr_event_count g_fr_events;
+
+/* set while a trace is being replayed, guarded by the frame pool lock */
+static bool g_fr_replaying;
+
+#ifdef FR_REPLAY
+/*
+ * State of the report which is swapped between live and replay for each
+ * chunk of packets, so the replay starts from nothing and the live report
+ * goes on between chunks as if nothing happened.
+ */
+struct fr_replay_saved {
+	unsigned long current_touch;
+	unsigned long previous_touch;
+	struct mutual_touch_point last_point[MAX_TOUCH_NUM];
+#ifdef MT_B_TYPE
+	uint32_t cadence_us;
+	bool pending;
+	unsigned long pending_touch;
+	struct mutual_touch_info pending_data;
+	struct fr_predict predict;
+#endif
+};
+
+struct fr_replay {
+	/* an input device never registered drops every event reported to it */
+	struct input_dev *dummy;
+	struct fr_replay_saved live;
+	struct fr_replay_saved replay;
+	struct core_fr_replay_stat stat;
+};
+
+static struct fr_replay *g_fr_replay;
+#endif /* FR_REPLAY */
+
+/* Frames replayed or raised by the emulator come with no irq, so they aren't timed */
+static inline void fr_latency_mark(int stage)
+{
+	if (!g_fr_replaying && !core_bus->no_irq)
+		core_latency_mark(stage);
+}
 
 /* the total length of finger report packet */
 uint16_t g_total_len = 0;
 
 struct mutual_touch_info g_mutual_data;
-struct fr_data_node *g_fr_node = NULL, *g_fr_uart = NULL;
+struct fr_data_node *g_fr_node = NULL;
+struct fr_frame_pool g_fr_pool;
+
+/* The length of packet for each of fw modes, indexed by the mode */
+static uint16_t g_fr_len_table[256];
+
+/*
+ * A 16.16 fixed point matrix which maps a point from panel to screen,
+ * out = (m[0] * x + m[1] * y + m[2]) >> 16, clamped to [0, max].
+ */
+struct fr_transform {
+	int32_t mx[3];
+	int32_t my[3];
+	int32_t max_x;
+	int32_t max_y;
+};
+
+static struct fr_transform g_fr_transform;
 struct core_fr_data *core_fr = NULL;
 
+/*
+ * The checksum only keeps the low byte of sum, so bytes are added a word at
+ * a time into 16-bit lanes, (w & 0x00FF..) + ((w >> 8) & 0x00FF..), and the
+ * lanes are folded by a multiply before any of them could overflow.
+ */
+#define CSUM_LANE_ONES		(~0UL / 0xFFFF)
+#define CSUM_LANE_MASK		(CSUM_LANE_ONES * 0xFF)
+#define CSUM_FOLD_WORDS		128
+
+/**
+ * Add bytes to a checksum, it can be called as many times as data comes in.
+ *
+ * @csum: initialised by core_fr_checksum_init()
+ * @buf: data, no alignment is needed
+ * @len: the length of data
+ */
+void core_fr_checksum_update(struct core_fr_checksum *csum, const uint8_t *buf, uint32_t len)
+{
+	uint32_t sum = csum->sum;
+	unsigned long acc, w;
+	int n;
+
+	while (len >= sizeof(unsigned long)) {
+		acc = 0;
+		for (n = 0; n < CSUM_FOLD_WORDS && len >= sizeof(unsigned long); n++) {
+			w = get_unaligned((const unsigned long *)buf);
+			acc += (w & CSUM_LANE_MASK) + ((w >> 8) & CSUM_LANE_MASK);
+			buf += sizeof(unsigned long);
+			len -= sizeof(unsigned long);
+		}
+		/* only the low byte of each lane counts, so the fold can't carry */
+		sum += ((acc & CSUM_LANE_MASK) * CSUM_LANE_ONES) >> (BITS_PER_LONG - 16);
+	}
+
+	while (len--)
+		sum += *buf++;
+
+	csum->sum = sum;
+}
+EXPORT_SYMBOL(core_fr_checksum_update);
+
 /**
  * Calculate the check sum of each packet reported by firmware
  *
@@ -78,6 +259,18 @@ struct core_fr_data *core_fr = NULL;
  * @nLength : the length of its packet
  */
 uint8_t core_fr_calc_checksum(uint8_t *pMsg, uint32_t nLength)
+{
+	struct core_fr_checksum csum;
+
+	core_fr_checksum_init(&csum);
+	core_fr_checksum_update(&csum, pMsg, nLength);
+	return core_fr_checksum_final(&csum);
+}
+EXPORT_SYMBOL(core_fr_calc_checksum);
+
+#ifdef CHECKSUM_BENCH
+/* The checksum summed byte by byte, kept as reference for the bench */
+static uint8_t fr_checksum_bytewise(uint8_t *pMsg, uint32_t nLength)
 {
 	int i;
 	int32_t nCheckSum = 0;
@@ -88,57 +281,114 @@ uint8_t core_fr_calc_checksum(uint8_t *pMsg, uint32_t nLength)
 
 	return (uint8_t) ((-nCheckSum) & 0xFF);
 }
-EXPORT_SYMBOL(core_fr_calc_checksum);
+
+/**
+ * Compare core_fr_calc_checksum() with the bytewise one over random buffers
+ * with random lengths and alignments, and time both of them.
+ *
+ * @loops: the number of buffers
+ * @ref_ns: the time spent by bytewise checksum
+ * @fast_ns: the time spent by core_fr_calc_checksum()
+ *
+ * Returns the number of buffers on which both are different.
+ */
+int core_fr_checksum_bench(int loops, uint64_t *ref_ns, uint64_t *fast_ns)
+{
+	int i, mismatch = 0;
+	uint16_t len = 0, offset = 0;
+	uint8_t ref, fast, *buf = NULL;
+	ktime_t start;
+
+	*ref_ns = 0;
+	*fast_ns = 0;
+
+	buf = kmalloc(FR_USER_FRAME_SIZE + sizeof(unsigned long), GFP_KERNEL);
+	if (ERR_ALLOC_MEM(buf)) {
+		ipio_err("Failed to allocate buf mem, %ld\n", PTR_ERR(buf));
+		return -ENOMEM;
+	}
+
+	get_random_bytes(buf, FR_USER_FRAME_SIZE + sizeof(unsigned long));
+
+	for (i = 0; i < loops; i++) {
+		get_random_bytes(&len, sizeof(len));
+		get_random_bytes(&offset, sizeof(offset));
+		len %= FR_USER_FRAME_SIZE + 1;
+		offset %= sizeof(unsigned long);
+
+		start = ktime_get();
+		ref = fr_checksum_bytewise(buf + offset, len);
+		*ref_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		start = ktime_get();
+		fast = core_fr_calc_checksum(buf + offset, len);
+		*fast_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		if (ref != fast) {
+			ipio_err("checksum mismatch, len = %d, offset = %d, ref = %x, fast = %x\n",
+				len, offset, ref, fast);
+			mismatch++;
+		}
+	}
+
+	kfree(buf);
+	return mismatch;
+}
+EXPORT_SYMBOL(core_fr_checksum_bench);
+#endif /* CHECKSUM_BENCH */
+
+/**
+ * Work out the length of data carried by an i2cuart packet from its header,
+ * where data[1] * data[2] is the count of data and the low nibble of data[3]
+ * is the type telling the bytes of each one. A checksum follows the data.
+ *
+ * @data: the first 4 bytes of i2cuart packet at least
+ */
+int core_fr_i2cuart_data_len(uint8_t *data)
+{
+	static const uint8_t one_data_bytes[16] = {1, 1, 2, 2, 4, 4, 1};
+	int type = data[3] & 0x0F;
+
+	return data[1] * data[2] * one_data_bytes[type] + 1;
+}
+EXPORT_SYMBOL(core_fr_i2cuart_data_len);
 
 /**
  *  Receive data when fw mode stays at i2cuart mode.
  *
  *  the first is to receive N bytes depending on the mode that firmware stays
  *  before going in this function, and it would check with i2c buffer if it
- *  remains the rest of data.
+ *  remains the rest of data. The rest is read into the frame pool right
+ *  after the first part, so users get the whole packet in one piece.
  */
 static void i2cuart_recv_packet(void)
 {
-	int res = 0, need_read_len = 0, one_data_bytes = 0;
-	int type = g_fr_node->data[3] & 0x0F;
+	int res = 0, need_read_len = 0, tail_len = 0;
 	int actual_len = g_fr_node->len - 5;
 
-	ipio_debug(DEBUG_FINGER_REPORT, "pid = %x, data[3] = %x, type = %x, actual_len = %d\n",
-	    g_fr_node->data[0], g_fr_node->data[3], type, actual_len);
-
-	need_read_len = g_fr_node->data[1] * g_fr_node->data[2];
-
-	if (type == 0 || type == 1 || type == 6) {
-		one_data_bytes = 1;
-	} else if (type == 2 || type == 3) {
-		one_data_bytes = 2;
-	} else if (type == 4 || type == 5) {
-		one_data_bytes = 4;
-	}
+	need_read_len = core_fr_i2cuart_data_len(g_fr_node->data);
 
-	ipio_debug(DEBUG_FINGER_REPORT, "need_read_len = %d  one_data_bytes = %d\n", need_read_len, one_data_bytes);
+	ipio_debug(DEBUG_FINGER_REPORT, "pid = %x, data[3] = %x, actual_len = %d, need_read_len = %d\n",
+	    g_fr_node->data[0], g_fr_node->data[3], actual_len, need_read_len);
 
-	need_read_len = need_read_len * one_data_bytes + 1;
-
-	if (need_read_len > actual_len) {
-		g_fr_uart = kmalloc(sizeof(*g_fr_uart), GFP_ATOMIC);
-		if (ERR_ALLOC_MEM(g_fr_uart)) {
-			ipio_err("Failed to allocate g_fr_uart memory %ld\n", PTR_ERR(g_fr_uart));
-			return;
-		}
+	if (need_read_len <= actual_len)
+		return;
 
-		g_fr_uart->len = need_read_len - actual_len;
-		g_fr_uart->data = kzalloc(g_fr_uart->len, GFP_ATOMIC);
-		if (ERR_ALLOC_MEM(g_fr_uart->data)) {
-			ipio_err("Failed to allocate g_fr_uart memory %ld\n", PTR_ERR(g_fr_uart->data));
-			return;
-		}
+	tail_len = need_read_len - actual_len;
+	if (g_fr_node->len + tail_len > g_fr_pool.size) {
+		ipio_err("The rest of i2cuart data (%d) is over frame pool (%d)\n",
+			tail_len, g_fr_pool.size);
+		return;
+	}
 
-		g_total_len += g_fr_uart->len;
-		res = core_read(core_config->slave_i2c_addr, g_fr_uart->data, g_fr_uart->len);
-		if (res < 0)
-			ipio_err("Failed to read finger report packet\n");
+	res = core_read(core_config->slave_i2c_addr, g_fr_node->data + g_fr_node->len, tail_len);
+	if (res < 0) {
+		ipio_err("Failed to read finger report packet\n");
+		return;
 	}
+
+	g_fr_node->len += tail_len;
+	g_total_len += tail_len;
 }
 
 /*
@@ -153,6 +403,7 @@ static void i2cuart_recv_packet(void)
 void core_fr_touch_press(int32_t x, int32_t y, uint32_t pressure, int32_t id)
 {
 	ipio_debug(DEBUG_FINGER_REPORT, "DOWN: id = %d, x = %d, y = %d\n", id, x, y);
+	g_fr_events.press++;
 
 #ifdef MT_B_TYPE
 	input_mt_slot(core_fr->input_device, id);
@@ -190,6 +441,7 @@ EXPORT_SYMBOL(core_fr_touch_press);
 void core_fr_touch_release(int32_t x, int32_t y, int32_t id)
 {
 	ipio_debug(DEBUG_FINGER_REPORT, "UP: id = %d, x = %d, y = %d\n", id, x, y);
+	g_fr_events.release++;
 
 #ifdef MT_B_TYPE
 	input_mt_slot(core_fr->input_device, id);
@@ -201,6 +453,413 @@ void core_fr_touch_release(int32_t x, int32_t y, int32_t id)
 }
 EXPORT_SYMBOL(core_fr_touch_release);
 
+/*
+ * Lift all fingers being held on a screen, used when the report is
+ * going to stop such as suspend.
+ */
+void core_fr_touch_release_all(void)
+{
+#ifdef MT_B_TYPE
+	int i;
+
+	/* the flush takes the pool lock, so it's stopped before taking it */
+	hrtimer_cancel(&g_fr_coalesce.timer);
+	cancel_work_sync(&g_fr_coalesce.flush);
+
+	mutex_lock(&g_fr_pool.lock);
+
+	for_each_set_bit(i, &g_previous_touch, MAX_TOUCH_NUM)
+		core_fr_touch_release(0, 0, i);
+
+	/* a frame merged before must not press slots again after this */
+	g_fr_coalesce.pending = false;
+	g_current_touch = 0;
+	g_previous_touch = 0;
+
+	input_report_key(core_fr->input_device, BTN_TOUCH, 0);
+	input_report_key(core_fr->input_device, BTN_TOOL_FINGER, 0);
+#else
+	mutex_lock(&g_fr_pool.lock);
+
+	core_fr_touch_release(0, 0, 0);
+#endif /* MT_B_TYPE */
+
+	input_sync(core_fr->input_device);
+
+	mutex_unlock(&g_fr_pool.lock);
+}
+EXPORT_SYMBOL(core_fr_touch_release_all);
+
+#ifdef MT_B_TYPE
+/*
+ * A finger stays on the slot but moves, only the axes changed are reported.
+ */
+static void fr_touch_move(struct mutual_touch_point *p, struct mutual_touch_point *last)
+{
+	ipio_debug(DEBUG_FINGER_REPORT, "MOVE: id = %d, x = %d, y = %d\n", p->id, p->x, p->y);
+	g_fr_events.move++;
+
+	input_mt_slot(core_fr->input_device, p->id);
+
+	if (p->x != last->x)
+		input_report_abs(core_fr->input_device, ABS_MT_POSITION_X, p->x);
+	if (p->y != last->y)
+		input_report_abs(core_fr->input_device, ABS_MT_POSITION_Y, p->y);
+	if (core_fr->isEnablePressure && p->pressure != last->pressure)
+		input_report_abs(core_fr->input_device, ABS_MT_PRESSURE, p->pressure);
+}
+
+/*
+ * Compare slots with the last frame and report the changes only. Fingers
+ * which stay still don't generate any events.
+ *
+ * Return true if anything has been reported and needs a sync.
+ */
+static bool fr_report_slots(void)
+{
+	int i;
+	bool changed = false;
+	unsigned long pressed, released;
+	struct mutual_touch_point *p, *last;
+
+	pressed = g_current_touch & ~g_previous_touch;
+	released = g_previous_touch & ~g_current_touch;
+
+	ipio_debug(DEBUG_FINGER_REPORT, "slots: prev = 0x%lx, cur = 0x%lx, press = 0x%lx, release = 0x%lx\n",
+		g_previous_touch, g_current_touch, pressed, released);
+
+	for (i = 0; i < g_mutual_data.touch_num; i++) {
+		p = &g_mutual_data.mtp[i];
+		last = &g_last_point[p->id];
+
+		if (test_bit(p->id, &pressed))
+			core_fr_touch_press(p->x, p->y, p->pressure, p->id);
+		else if (p->x != last->x || p->y != last->y || p->pressure != last->pressure)
+			fr_touch_move(p, last);
+		else
+			continue;
+
+		*last = *p;
+		changed = true;
+	}
+
+	for_each_set_bit(i, &released, MAX_TOUCH_NUM) {
+		core_fr_touch_release(0, 0, i);
+		changed = true;
+	}
+
+	/* BTN_TOUCH only changes with the first finger down or the last one up */
+	if (g_previous_touch == 0 && g_current_touch != 0) {
+		input_report_key(core_fr->input_device, BTN_TOUCH, 1);
+		input_report_key(core_fr->input_device, BTN_TOOL_FINGER, 1);
+	} else if (g_previous_touch != 0 && g_current_touch == 0) {
+		input_report_key(core_fr->input_device, BTN_TOUCH, 0);
+		input_report_key(core_fr->input_device, BTN_TOOL_FINGER, 0);
+	}
+
+	g_previous_touch = g_current_touch;
+	return changed;
+}
+
+/*
+ * Return true if the frame just parsed is merged and mustn't be reported.
+ * Called with the frame pool lock held.
+ */
+static bool fr_coalesce_frame(void)
+{
+	ktime_t now;
+
+	g_fr_coalesce.stat.frames++;
+
+	if (g_fr_coalesce.cadence_us == 0)
+		return false;
+
+	now = ktime_get();
+
+	if (g_current_touch != g_previous_touch ||
+		ktime_us_delta(now, g_fr_coalesce.last_report) >= g_fr_coalesce.cadence_us) {
+		/* this frame carries the latest state, so whatever is pending goes with it */
+		if (g_fr_coalesce.pending)
+			g_fr_coalesce.stat.merged++;
+		g_fr_coalesce.pending = false;
+		g_fr_coalesce.last_report = now;
+		return false;
+	}
+
+	if (g_fr_coalesce.pending)
+		g_fr_coalesce.stat.merged++;
+
+	g_fr_coalesce.pending_data = g_mutual_data;
+	g_fr_coalesce.pending_touch = g_current_touch;
+	g_fr_coalesce.pending = true;
+
+	if (!hrtimer_active(&g_fr_coalesce.timer))
+		hrtimer_start(&g_fr_coalesce.timer,
+			ktime_add_us(g_fr_coalesce.last_report, g_fr_coalesce.cadence_us), HRTIMER_MODE_ABS);
+
+	return true;
+}
+
+static void fr_coalesce_flush(struct work_struct *work)
+{
+	mutex_lock(&g_fr_pool.lock);
+
+	if (g_fr_coalesce.pending) {
+		g_mutual_data = g_fr_coalesce.pending_data;
+		g_current_touch = g_fr_coalesce.pending_touch;
+		g_fr_coalesce.pending = false;
+		g_fr_coalesce.last_report = ktime_get();
+		g_fr_coalesce.stat.flushed++;
+
+		if (fr_report_slots()) {
+			input_sync(core_fr->input_device);
+			g_fr_events.sync++;
+		}
+	}
+
+	mutex_unlock(&g_fr_pool.lock);
+}
+
+static enum hrtimer_restart fr_coalesce_timer(struct hrtimer *timer)
+{
+	queue_work(system_highpri_wq, &g_fr_coalesce.flush);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Measure the predictions of a slot whose time has come with the actual
+ * position at that time, interpolated between the last and this sample.
+ */
+static void fr_predict_measure(struct fr_predict_slot *s, int64_t now_ns, int32_t x, int32_t y)
+{
+	int64_t span = now_ns - s->last_ns;
+	int64_t ax, ay, dx, dy;
+	uint32_t err;
+	struct fr_predict_point *pp;
+
+	while (s->num > 0) {
+		pp = &s->pending[s->head];
+		if (pp->target_ns > now_ns)
+			break;
+
+		ax = s->x + div64_s64((int64_t)(x - s->x) * (pp->target_ns - s->last_ns), span);
+		ay = s->y + div64_s64((int64_t)(y - s->y) * (pp->target_ns - s->last_ns), span);
+		dx = pp->x - ax;
+		dy = pp->y - ay;
+		err = int_sqrt((unsigned long)(dx * dx + dy * dy));
+
+		g_fr_predict.stat.samples++;
+		g_fr_predict.stat.err_sum += err;
+		g_fr_predict.stat.err_max = max(g_fr_predict.stat.err_max, err);
+
+		s->head = (s->head + 1) % PREDICT_HISTORY;
+		s->num--;
+	}
+}
+
+/*
+ * Move every point of the frame just parsed forward by the horizon, from the
+ * velocity of its slot. A slot starts over at press, after release and
+ * after a gap, where the point is reported as it is.
+ */
+static void fr_predict_frame(int64_t now_ns)
+{
+	int i;
+	int32_t dt_us, vx, vy, px, py;
+	struct mutual_touch_point *p;
+	struct fr_predict_slot *s;
+	struct fr_predict_point *pp;
+
+	for (i = 0; i < g_mutual_data.touch_num; i++) {
+		p = &g_mutual_data.mtp[i];
+		s = &g_fr_predict.slot[p->id];
+
+		if (!s->valid || !test_bit(p->id, &g_previous_touch) ||
+			now_ns <= s->last_ns || now_ns - s->last_ns > PREDICT_GAP_US * NSEC_PER_USEC) {
+			memset(s, 0x0, sizeof(*s));
+			s->valid = true;
+			s->x = p->x;
+			s->y = p->y;
+			s->last_ns = now_ns;
+			continue;
+		}
+
+		fr_predict_measure(s, now_ns, p->x, p->y);
+
+		dt_us = (int32_t)div_s64(now_ns - s->last_ns, NSEC_PER_USEC);
+		if (dt_us <= 0)
+			dt_us = 1;
+
+		vx = (int32_t)div_s64((int64_t)(p->x - s->x) << 16, dt_us);
+		vy = (int32_t)div_s64((int64_t)(p->y - s->y) << 16, dt_us);
+		s->vx += (vx - s->vx) >> PREDICT_SMOOTH_SHIFT;
+		s->vy += (vy - s->vy) >> PREDICT_SMOOTH_SHIFT;
+
+		s->x = p->x;
+		s->y = p->y;
+		s->last_ns = now_ns;
+
+		px = p->x + (int32_t)(((int64_t)s->vx * g_fr_predict.horizon_us) >> 16);
+		py = p->y + (int32_t)(((int64_t)s->vy * g_fr_predict.horizon_us) >> 16);
+		px = clamp_t(int32_t, px, 0, g_fr_transform.max_x);
+		py = clamp_t(int32_t, py, 0, g_fr_transform.max_y);
+
+		if (s->num == PREDICT_HISTORY) {
+			s->head = (s->head + 1) % PREDICT_HISTORY;
+			s->num--;
+		}
+		pp = &s->pending[(s->head + s->num) % PREDICT_HISTORY];
+		pp->target_ns = now_ns + (int64_t)g_fr_predict.horizon_us * NSEC_PER_USEC;
+		pp->x = px;
+		pp->y = py;
+		s->num++;
+
+		p->x = px;
+		p->y = py;
+	}
+
+	/* slots released start over at next press */
+	for (i = 0; i < MAX_TOUCH_NUM; i++) {
+		if (!test_bit(i, &g_current_touch))
+			g_fr_predict.slot[i].valid = false;
+	}
+}
+#endif /* MT_B_TYPE */
+
+/**
+ * Tell the driver a frame is going to be displayed, so a frame merged
+ * by coalescing is reported now instead of waiting for its deadline.
+ * It can be called from any context by display drivers.
+ */
+void core_fr_vsync(void)
+{
+#ifdef MT_B_TYPE
+	if (READ_ONCE(g_fr_coalesce.pending))
+		queue_work(system_highpri_wq, &g_fr_coalesce.flush);
+#endif
+}
+EXPORT_SYMBOL(core_fr_vsync);
+
+/**
+ * Set the cadence of coalescing in us, 0 to report every frame.
+ * It's only supported by MT_B_TYPE.
+ */
+int core_fr_set_coalesce(uint32_t cadence_us)
+{
+#ifdef MT_B_TYPE
+	mutex_lock(&g_fr_pool.lock);
+	g_fr_coalesce.cadence_us = cadence_us;
+	mutex_unlock(&g_fr_pool.lock);
+
+	/* report anything still held by the old cadence */
+	if (cadence_us == 0)
+		core_fr_vsync();
+
+	ipio_info("coalesce cadence = %dus\n", cadence_us);
+	return 0;
+#else
+	ipio_err("Coalescing is only supported by MT_B_TYPE\n");
+	return -EINVAL;
+#endif
+}
+EXPORT_SYMBOL(core_fr_set_coalesce);
+
+void core_fr_get_coalesce(uint32_t *cadence_us, struct core_fr_coalesce_stat *stat)
+{
+#ifdef MT_B_TYPE
+	*cadence_us = g_fr_coalesce.cadence_us;
+	*stat = g_fr_coalesce.stat;
+#else
+	*cadence_us = 0;
+	memset(stat, 0x0, sizeof(*stat));
+#endif
+}
+EXPORT_SYMBOL(core_fr_get_coalesce);
+
+/**
+ * Set how far in ms points are predicted ahead, 0 to report them as they
+ * are. The error collected so far is cleared. It's only supported by MT_B_TYPE.
+ */
+int core_fr_set_predict(uint32_t horizon_ms)
+{
+#ifdef MT_B_TYPE
+	if (horizon_ms > PREDICT_HORIZON_MAX_MS) {
+		ipio_err("Horizon (%d) is over %dms\n", horizon_ms, PREDICT_HORIZON_MAX_MS);
+		return -EINVAL;
+	}
+
+	mutex_lock(&g_fr_pool.lock);
+	memset(&g_fr_predict, 0x0, sizeof(g_fr_predict));
+	g_fr_predict.horizon_us = horizon_ms * USEC_PER_MSEC;
+	mutex_unlock(&g_fr_pool.lock);
+
+	ipio_info("predict horizon = %dms\n", horizon_ms);
+	return 0;
+#else
+	ipio_err("Prediction is only supported by MT_B_TYPE\n");
+	return -EINVAL;
+#endif
+}
+EXPORT_SYMBOL(core_fr_set_predict);
+
+void core_fr_get_predict(uint32_t *horizon_ms, struct core_fr_predict_stat *stat)
+{
+#ifdef MT_B_TYPE
+	*horizon_ms = g_fr_predict.horizon_us / USEC_PER_MSEC;
+	*stat = g_fr_predict.stat;
+#else
+	*horizon_ms = 0;
+	memset(stat, 0x0, sizeof(*stat));
+#endif
+}
+EXPORT_SYMBOL(core_fr_get_predict);
+
+/*
+ * Interpret the points parsed into g_mutual_data and send input events to
+ * system, shared by all versions of protocol.
+ *
+ * @stamp_ns: when the packet was received
+ */
+static void fr_report_frame(int64_t stamp_ns)
+{
+#ifndef MT_B_TYPE
+	int i;
+	static int last_touch = 0;
+#endif
+
+#ifdef MT_B_TYPE
+	if (g_fr_predict.horizon_us)
+		fr_predict_frame(stamp_ns);
+
+	if (fr_coalesce_frame())
+		return;
+
+	if (fr_report_slots()) {
+		input_sync(core_fr->input_device);
+		g_fr_events.sync++;
+		fr_latency_mark(LATENCY_SYNC);
+	}
+#else
+	if (g_mutual_data.touch_num > 0) {
+		for (i = 0; i < g_mutual_data.touch_num; i++) {
+			core_fr_touch_press(g_mutual_data.mtp[i].x, g_mutual_data.mtp[i].y, g_mutual_data.mtp[i].pressure, g_mutual_data.mtp[i].id);
+		}
+		input_sync(core_fr->input_device);
+		g_fr_events.sync++;
+		fr_latency_mark(LATENCY_SYNC);
+
+		last_touch = g_mutual_data.touch_num;
+	} else if (last_touch > 0) {
+		core_fr_touch_release(0, 0, 0);
+		input_sync(core_fr->input_device);
+		g_fr_events.sync++;
+		fr_latency_mark(LATENCY_SYNC);
+
+		last_touch = 0;
+	}
+#endif /* MT_B_TYPE */
+}
+
 static int parse_touch_package_v3_2(void)
 {
 	ipio_info("Not implemented yet\n");
@@ -214,14 +873,94 @@ static int finger_report_ver_3_2(void)
 	return 0;
 }
 
+/*
+ * The layout of points in a packet. Each point takes 3 bytes at least, the
+ * high nibbles of first byte and the second byte are X, the low nibble
+ * and the third byte are Y.
+ *
+ * @stride: bytes between two points
+ * @offset: where the first point starts in a packet
+ * @pressure: where the pressure is from the start of a point, -1 if none
+ */
+struct fr_packet_desc {
+	uint8_t stride;
+	uint8_t offset;
+	int8_t pressure;
+};
+
+enum {
+	FR_DESC_DEMO = 0,
+	FR_DESC_DEBUG,
+};
+
+static const struct fr_packet_desc fr_desc[] = {
+	[FR_DESC_DEMO] = {.stride = 4, .offset = 1, .pressure = 3},
+	[FR_DESC_DEBUG] = {.stride = 3, .offset = 5, .pressure = -1},
+};
+
+static inline uint16_t fr_apply_transform(const int32_t *m, uint32_t x, uint32_t y, int32_t max)
+{
+	int32_t v = (int32_t)(((int64_t)m[0] * x + (int64_t)m[1] * y + m[2]) >> 16);
+
+	return clamp_t(int32_t, v, 0, max);
+}
+
+/*
+ * Decode all points in a packet into a compact array of contacts in one pass.
+ * Everything depending on settings is worked out before the loop so that
+ * the loop has no branches other than skipping empty points.
+ *
+ * Return a mask of slots being touched.
+ */
+static unsigned long fr_decode_points(const struct fr_packet_desc *desc, const uint8_t *data,
+				struct mutual_touch_info *info)
+{
+	int i;
+	unsigned long mask = 0;
+	const uint8_t *pt = data + desc->offset;
+	struct mutual_touch_point *mtp = info->mtp;
+	const struct fr_transform *t = &g_fr_transform;
+	uint32_t nX, nY;
+	uint8_t poff = 0, pmask = 0, pbias = 1;
+
+	/* pressure is 1 if it's disabled or not reported by the packet */
+	if (core_fr->isEnablePressure && desc->pressure >= 0) {
+		poff = desc->pressure;
+		pmask = 0xFF;
+		pbias = 0;
+	}
+
+	for (i = 0; i < MAX_TOUCH_NUM; i++, pt += desc->stride) {
+		if (pt[0] == 0xFF && pt[1] == 0xFF && pt[2] == 0xFF)
+			continue;
+
+		nX = ((pt[0] & 0xF0) << 4) | pt[1];
+		nY = ((pt[0] & 0x0F) << 8) | pt[2];
+
+		mtp->id = i;
+		mtp->x = fr_apply_transform(t->mx, nX, nY, t->max_x);
+		mtp->y = fr_apply_transform(t->my, nX, nY, t->max_y);
+		mtp->pressure = (pt[poff] & pmask) | pbias;
+
+		ipio_debug(DEBUG_FINGER_REPORT, "point[%d] : [x,y]=[%d,%d] -> (%d,%d) = %d\n",
+			mtp->id, nX, nY, mtp->x, mtp->y, mtp->pressure);
+
+		mask |= BIT(i);
+		mtp++;
+	}
+
+	info->touch_num = mtp - info->mtp;
+	return mask;
+}
+
 /*
  * It mainly parses the packet assembled by protocol v5.0
  */
 static int parse_touch_package_v5_0(uint8_t pid)
 {
-	int i, res = 0;
+	int res = 0;
 	uint8_t check_sum = 0;
-	uint32_t nX = 0, nY = 0;
+	const struct fr_packet_desc *desc = NULL;
 
 	dump_data(g_fr_node->data, 8, g_fr_node->len, 0, "touch report");
 
@@ -237,88 +976,15 @@ static int parse_touch_package_v5_0(uint8_t pid)
 	/* start to parsing the packet of finger report */
 	if (pid == protocol->demo_pid) {
 		ipio_debug(DEBUG_FINGER_REPORT, " **** Parsing DEMO packets : 0x%x ****\n", pid);
-
-		for (i = 0; i < MAX_TOUCH_NUM; i++) {
-			if ((g_fr_node->data[(4 * i) + 1] == 0xFF) && (g_fr_node->data[(4 * i) + 2] && 0xFF)
-			    && (g_fr_node->data[(4 * i) + 3] == 0xFF)) {
-#ifdef MT_B_TYPE
-				g_current_touch[i] = 0;
-#endif
-				continue;
-			}
-
-			nX = (((g_fr_node->data[(4 * i) + 1] & 0xF0) << 4) | (g_fr_node->data[(4 * i) + 2]));
-			nY = (((g_fr_node->data[(4 * i) + 1] & 0x0F) << 8) | (g_fr_node->data[(4 * i) + 3]));
-
-			if (!core_fr->isSetResolution) {
-				g_mutual_data.mtp[g_mutual_data.touch_num].x = nX * TOUCH_SCREEN_X_MAX / TPD_WIDTH;
-				g_mutual_data.mtp[g_mutual_data.touch_num].y = nY * TOUCH_SCREEN_Y_MAX / TPD_HEIGHT;
-				g_mutual_data.mtp[g_mutual_data.touch_num].id = i;
-			} else {
-				g_mutual_data.mtp[g_mutual_data.touch_num].x = nX;
-				g_mutual_data.mtp[g_mutual_data.touch_num].y = nY;
-				g_mutual_data.mtp[g_mutual_data.touch_num].id = i;
-			}
-
-			if (core_fr->isEnablePressure)
-				g_mutual_data.mtp[g_mutual_data.touch_num].pressure = g_fr_node->data[(4 * i) + 4];
-			else
-				g_mutual_data.mtp[g_mutual_data.touch_num].pressure = 1;
-
-			ipio_debug(DEBUG_FINGER_REPORT, "[x,y]=[%d,%d]\n", nX, nY);
-			ipio_debug(DEBUG_FINGER_REPORT, "point[%d] : (%d,%d) = %d\n",
-			    g_mutual_data.mtp[g_mutual_data.touch_num].id,
-			    g_mutual_data.mtp[g_mutual_data.touch_num].x,
-			    g_mutual_data.mtp[g_mutual_data.touch_num].y, g_mutual_data.mtp[g_mutual_data.touch_num].pressure);
-
-			g_mutual_data.touch_num++;
-
-#ifdef MT_B_TYPE
-			g_current_touch[i] = 1;
-#endif
-		}
+		desc = &fr_desc[FR_DESC_DEMO];
 	} else if (pid == protocol->debug_pid) {
 		ipio_debug(DEBUG_FINGER_REPORT, " **** Parsing DEBUG packets : 0x%x ****\n", pid);
 		ipio_debug(DEBUG_FINGER_REPORT, "Length = %d\n", (g_fr_node->data[1] << 8 | g_fr_node->data[2]));
-
-		for (i = 0; i < MAX_TOUCH_NUM; i++) {
-			if ((g_fr_node->data[(3 * i) + 5] == 0xFF) && (g_fr_node->data[(3 * i) + 6] && 0xFF)
-			    && (g_fr_node->data[(3 * i) + 7] == 0xFF)) {
-#ifdef MT_B_TYPE
-				g_current_touch[i] = 0;
-#endif
-				continue;
-			}
-
-			nX = (((g_fr_node->data[(3 * i) + 5] & 0xF0) << 4) | (g_fr_node->data[(3 * i) + 6]));
-			nY = (((g_fr_node->data[(3 * i) + 5] & 0x0F) << 8) | (g_fr_node->data[(3 * i) + 7]));
-
-			if (!core_fr->isSetResolution) {
-				g_mutual_data.mtp[g_mutual_data.touch_num].x = nX * TOUCH_SCREEN_X_MAX / TPD_WIDTH;
-				g_mutual_data.mtp[g_mutual_data.touch_num].y = nY * TOUCH_SCREEN_Y_MAX / TPD_HEIGHT;
-				g_mutual_data.mtp[g_mutual_data.touch_num].id = i;
-			} else {
-				g_mutual_data.mtp[g_mutual_data.touch_num].x = nX;
-				g_mutual_data.mtp[g_mutual_data.touch_num].y = nY;
-				g_mutual_data.mtp[g_mutual_data.touch_num].id = i;
-			}
-
-			if (core_fr->isEnablePressure)
-				g_mutual_data.mtp[g_mutual_data.touch_num].pressure = g_fr_node->data[(4 * i) + 4];
-			else
-				g_mutual_data.mtp[g_mutual_data.touch_num].pressure = 1;
-
-			ipio_debug(DEBUG_FINGER_REPORT, "[x,y]=[%d,%d]\n", nX, nY);
-			ipio_debug(DEBUG_FINGER_REPORT, "point[%d] : (%d,%d) = %d\n",
-			    g_mutual_data.mtp[g_mutual_data.touch_num].id,
-			    g_mutual_data.mtp[g_mutual_data.touch_num].x,
-			    g_mutual_data.mtp[g_mutual_data.touch_num].y, g_mutual_data.mtp[g_mutual_data.touch_num].pressure);
-
-			g_mutual_data.touch_num++;
-
-#ifdef MT_B_TYPE
-			g_current_touch[i] = 1;
-#endif
+		desc = &fr_desc[FR_DESC_DEBUG];
+		/* live readers only get frames from the panel */
+		if (!g_fr_replaying) {
+			core_heatmap_decode(g_fr_node->data, g_fr_node->len);
+			ilitek_v4l2_push(g_fr_node->data, g_fr_node->len);
 		}
 	} else {
 		if (pid != 0) {
@@ -326,44 +992,33 @@ static int parse_touch_package_v5_0(uint8_t pid)
 			ipio_err(" **** Unknown PID : 0x%x ****\n", pid);
 			res = -1;
 		}
+		goto out;
 	}
 
+	g_current_touch = fr_decode_points(desc, g_fr_node->data, &g_mutual_data);
+
 out:
 	return res;
 }
 
 /*
- * The function is called by an interrupt and used to handle packet of finger
- * touch from firmware. A differnece in the process of the data is acorrding to the protocol
+ * Parse a packet already in g_fr_node and send input events to system,
+ * shared by the interrupt and the replay of recorded packets.
+ *
+ * @stamp_ns: when the packet was received
  */
-static int finger_report_ver_5_0(void)
+static int fr_process_ver_5_0(int64_t stamp_ns)
 {
-	int i, gesture, res = 0;
-	static int last_touch = 0;
+	int gesture, res = 0;
 	uint8_t pid = 0x0;
-
 	memset(&g_mutual_data, 0x0, sizeof(struct mutual_touch_info));
 
-#ifdef I2C_SEGMENT
-	res = core_i2c_segmental_read(core_config->slave_i2c_addr, g_fr_node->data, g_fr_node->len);
-#else
-	res = core_read(core_config->slave_i2c_addr, g_fr_node->data, g_fr_node->len);
-#endif
-
-	if (res < 0) {
-		ipio_err("Failed to read finger report packet\n");
-
-		goto out;
-	}
-
 	pid = g_fr_node->data[0];
 	ipio_debug(DEBUG_FINGER_REPORT, "PID = 0x%x\n", pid);
 
-	if (pid == protocol->i2cuart_pid) {
-		ipio_debug(DEBUG_FINGER_REPORT, "I2CUART(0x%x): prepare to receive rest of data\n", pid);
-		i2cuart_recv_packet();
+	/* the rest of i2cuart data was read with the packet, nothing to parse */
+	if (pid == protocol->i2cuart_pid)
 		goto out;
-	}
 
 	if (pid == protocol->ges_pid && core_config->isEnableGesture) {
 		ipio_debug(DEBUG_FINGER_REPORT, "pid = 0x%x, code = %x\n", pid, g_fr_node->data[1]);
@@ -383,62 +1038,43 @@ static int finger_report_ver_5_0(void)
 		goto out;
 	}
 
-	ipio_debug(DEBUG_FINGER_REPORT, "Touch Num = %d, LastTouch = %d\n", g_mutual_data.touch_num, last_touch);
+	fr_latency_mark(LATENCY_PARSE);
 
-	/* interpret parsed packat and send input events to system */
-	if (g_mutual_data.touch_num > 0) {
-#ifdef MT_B_TYPE
-		for (i = 0; i < g_mutual_data.touch_num; i++) {
-			input_report_key(core_fr->input_device, BTN_TOUCH, 1);
-			core_fr_touch_press(g_mutual_data.mtp[i].x, g_mutual_data.mtp[i].y, g_mutual_data.mtp[i].pressure, g_mutual_data.mtp[i].id);
+	ipio_debug(DEBUG_FINGER_REPORT, "Touch Num = %d\n", g_mutual_data.touch_num);
 
-			input_report_key(core_fr->input_device, BTN_TOOL_FINGER, 1);
-		}
+	fr_report_frame(stamp_ns);
 
-		for (i = 0; i < MAX_TOUCH_NUM; i++) {
-			ipio_debug(DEBUG_FINGER_REPORT, "g_previous_touch[%d]=%d, g_current_touch[%d]=%d\n", i,
-			    g_previous_touch[i], i, g_current_touch[i]);
+out:
+	return res;
+}
 
-			if (g_current_touch[i] == 0 && g_previous_touch[i] == 1) {
-				core_fr_touch_release(0, 0, i);
-			}
+/*
+ * The function is called by an interrupt and used to handle packet of finger
+ * touch from firmware. A differnece in the process of the data is acorrding to the protocol
+ */
+static int finger_report_ver_5_0(void)
+{
+	int res = 0;
 
-			g_previous_touch[i] = g_current_touch[i];
-		}
+#ifdef I2C_SEGMENT
+	res = core_i2c_segmental_read(core_config->slave_i2c_addr, g_fr_node->data, g_fr_node->len);
 #else
-		for (i = 0; i < g_mutual_data.touch_num; i++) {
-			core_fr_touch_press(g_mutual_data.mtp[i].x, g_mutual_data.mtp[i].y, g_mutual_data.mtp[i].pressure, g_mutual_data.mtp[i].id);
-		}
+	res = core_read(core_config->slave_i2c_addr, g_fr_node->data, g_fr_node->len);
 #endif
-		input_sync(core_fr->input_device);
 
-		last_touch = g_mutual_data.touch_num;
-	} else {
-		if (last_touch > 0) {
-#ifdef MT_B_TYPE
-			for (i = 0; i < MAX_TOUCH_NUM; i++) {
-				ipio_debug(DEBUG_FINGER_REPORT, "g_previous_touch[%d]=%d, g_current_touch[%d]=%d\n", i,
-				    g_previous_touch[i], i, g_current_touch[i]);
-
-				if (g_current_touch[i] == 0 && g_previous_touch[i] == 1) {
-					core_fr_touch_release(0, 0, i);
-				}
-				g_previous_touch[i] = g_current_touch[i];
-			}
-			input_report_key(core_fr->input_device, BTN_TOUCH, 0);
-			input_report_key(core_fr->input_device, BTN_TOOL_FINGER, 0);
-#else
-			core_fr_touch_release(0, 0, 0);
-#endif
+	if (res < 0) {
+		ipio_err("Failed to read finger report packet\n");
+		return res;
+	}
 
-			input_sync(core_fr->input_device);
+	fr_latency_mark(LATENCY_READ);
 
-			last_touch = 0;
-		}
+	if (g_fr_node->data[0] == protocol->i2cuart_pid) {
+		ipio_debug(DEBUG_FINGER_REPORT, "I2CUART(0x%x): prepare to receive rest of data\n", g_fr_node->data[0]);
+		i2cuart_recv_packet();
 	}
 
-out:
-	return res;
+	return fr_process_ver_5_0(ktime_to_ns(ktime_get()));
 }
 
 int core_fr_mode_control(uint8_t *from_user)
@@ -562,7 +1198,7 @@ EXPORT_SYMBOL(core_fr_mode_control);
  * firmware and the number we calculated, in this case I just print an error to inform users
  * and still send up to users.
  */
-static uint16_t calc_packet_length(void)
+static uint16_t calc_packet_length(uint8_t mode)
 {
 	uint16_t xch = 0, ych = 0, stx = 0, srx = 0;
 	/* FIXME: self_key not defined by firmware yet */
@@ -577,33 +1213,33 @@ static uint16_t calc_packet_length(void)
 			srx = core_config->tp_info->self_rx_channel_num;
 		}
 
-		ipio_debug(DEBUG_FINGER_REPORT, "firmware mode : 0x%x\n", core_fr->actual_fw_mode);
+		ipio_debug(DEBUG_FINGER_REPORT, "firmware mode : 0x%x\n", mode);
 
-		if (protocol->demo_mode == core_fr->actual_fw_mode) {
+		if (protocol->demo_mode == mode) {
 			rlen = protocol->demo_len;
-		} else if (protocol->test_mode == core_fr->actual_fw_mode) {
+		} else if (protocol->test_mode == mode) {
 			if (ERR_ALLOC_MEM(core_config->tp_info)) {
 				rlen = protocol->test_len;
 			} else {
 				rlen = (2 * xch * ych) + (stx * 2) + (srx * 2) + 2 * self_key + 1;
 				rlen += 1;
 			}
-		} else if (protocol->debug_mode == core_fr->actual_fw_mode) {
+		} else if (protocol->debug_mode == mode) {
 			if (ERR_ALLOC_MEM(core_config->tp_info)) {
 				rlen = protocol->debug_len;
 			} else {
 				rlen = (2 * xch * ych) + (stx * 2) + (srx * 2) + 2 * self_key + (8 * 2) + 1;
 				rlen += 35;
 			}
-		} else if (protocol->gesture_mode == core_fr->actual_fw_mode) {
-			if(core_gesture->mode == GESTURE_NORMAL_MODE)
+		} else if (protocol->gesture_mode == mode) {
+			if(core_gesture != NULL && core_gesture->mode == GESTURE_NORMAL_MODE)
 				rlen = GESTURE_MORMAL_LENGTH;
 			else
 				rlen = GESTURE_INFO_LENGTH;
 			ipio_debug(DEBUG_FINGER_REPORT, "rlen = %d\n", rlen);
 		}
 		else {
-			ipio_err("Unknown firmware mode : %d\n", core_fr->actual_fw_mode);
+			ipio_err("Unknown firmware mode : %d\n", mode);
 			rlen = 0;
 		}
 	} else {
@@ -615,6 +1251,89 @@ static uint16_t calc_packet_length(void)
 	return rlen;
 }
 
+/**
+ * Make sure the frame pool is able to hold a packet with the size. It must be
+ * called from a context that can sleep, and the pool only grows, so a packet
+ * being handled is never truncated.
+ */
+static int fr_pool_resize(uint16_t size)
+{
+	uint8_t *frame = NULL, *old = NULL;
+
+	if (size <= g_fr_pool.size)
+		return 0;
+
+	/* debug mode packets are read into it by DMA without a bounce */
+	frame = core_i2c_dma_alloc(size);
+	if (ERR_ALLOC_MEM(frame)) {
+		ipio_err("Failed to allocate frame pool mem, %ld\n", PTR_ERR(frame));
+		return -ENOMEM;
+	}
+
+	mutex_lock(&g_fr_pool.lock);
+	old = g_fr_pool.frame;
+	g_fr_pool.frame = frame;
+	g_fr_pool.size = size;
+	mutex_unlock(&g_fr_pool.lock);
+
+	if (old != NULL)
+		core_i2c_dma_free(old);
+
+	ipio_info("frame pool size = %d\n", g_fr_pool.size);
+	return 0;
+}
+
+/**
+ * Rebuild the length of packet for every fw mode. The length only changes with
+ * protocol, tp info or gesture mode, so it must be called whenever one of them
+ * is updated, and the interrupt path simply looks it up by the mode.
+ */
+int core_fr_update_len_table(void)
+{
+	int i, j, res = 0;
+	uint16_t len[4] = { 0 }, size = 0;
+	uint8_t modes[4] = {
+		protocol->demo_mode,
+		protocol->test_mode,
+		protocol->debug_mode,
+		protocol->gesture_mode,
+	};
+
+	if (protocol->major == 0x5) {
+		for (i = 0; i < ARRAY_SIZE(modes); i++) {
+			len[i] = calc_packet_length(modes[i]);
+			size = max_t(uint16_t, size, len[i]);
+		}
+	}
+
+	/* the rest of i2cuart data is read into the pool after the first part */
+	size = max_t(uint16_t, size, FR_USER_FRAME_SIZE);
+
+	/* gesture mode might be changed by users without switching fw mode */
+	size = max_t(uint16_t, size, GESTURE_INFO_LENGTH);
+	size = max_t(uint16_t, size, protocol->debug_len);
+	size = max_t(uint16_t, size, protocol->test_len);
+
+	/* The pool must be grown before any of longer lengths is seen by the interrupt */
+	res = fr_pool_resize(size);
+	if (res < 0)
+		return res;
+
+	/* Fill each entry once, so the interrupt never sees a zero of the valid mode */
+	for (i = 0; i < ARRAY_SIZE(g_fr_len_table); i++) {
+		for (j = 0; j < ARRAY_SIZE(modes); j++) {
+			if (modes[j] == i)
+				break;
+		}
+		g_fr_len_table[i] = (j < ARRAY_SIZE(modes)) ? len[j] : 0;
+	}
+
+	ipio_info("packet length: demo = %d, test = %d, debug = %d, gesture = %d\n",
+		len[0], len[1], len[2], len[3]);
+	return 0;
+}
+EXPORT_SYMBOL(core_fr_update_len_table);
+
 /**
  * The table is used to handle calling functions that deal with packets of finger report.
  * The callback function might be different of what a protocol is used on a chip.
@@ -635,6 +1354,40 @@ fr_hashtable fr_t[] = {
 	{0x5, 0x1, finger_report_ver_5_0},
 };
 
+/* The callback picked from fr_t for the current protocol */
+static int (*g_fr_report)(void);
+
+/**
+ * Look up the callback of finger report once the version of protocol is known,
+ * so the interrupt doesn't need to scan the table for every packet.
+ */
+void core_fr_update_report(void)
+{
+	int i;
+	int (*report)(void) = NULL;
+
+	for (i = 0; i < ARRAY_SIZE(fr_t); i++) {
+		if (protocol->major == fr_t[i].protocol_marjor_ver &&
+		    protocol->mid == fr_t[i].protocol_minor_ver) {
+			report = fr_t[i].finger_report;
+			break;
+		}
+	}
+
+	/* The minor version might be newer than the table, follow its major */
+	for (i = 0; report == NULL && i < ARRAY_SIZE(fr_t); i++) {
+		if (protocol->major == fr_t[i].protocol_marjor_ver)
+			report = fr_t[i].finger_report;
+	}
+
+	if (report == NULL)
+		ipio_err("Can't find any callback functions for protocol %x.%x\n",
+			protocol->major, protocol->mid);
+
+	WRITE_ONCE(g_fr_report, report);
+}
+EXPORT_SYMBOL(core_fr_update_report);
+
 /**
  * The function is an entry for the work queue registered by ISR activates.
  *
@@ -643,8 +1396,7 @@ fr_hashtable fr_t[] = {
  */
 void core_fr_handler(void)
 {
-	int i = 0;
-	uint8_t *tdata = NULL;
+	int (*report)(void) = READ_ONCE(g_fr_report);
 /* huaqin add for ZQL1830-1201 by liufurong at 20180927 start */
        if (core_fr == NULL) {
                ipio_err("core_fr is Invalid \n");
@@ -662,122 +1414,315 @@ void core_fr_handler(void)
 		return;
 	}
 
-	if (ipd->isEnablePollCheckPower) {
-		mutex_lock(&ipd->plat_mutex);
-		cancel_delayed_work_sync(&ipd->check_power_status_work);
-		mutex_unlock(&ipd->plat_mutex);
-	}
-	if (ipd->isEnablePollCheckEsd) {
-		mutex_lock(&ipd->plat_mutex);
-		cancel_delayed_work_sync(&ipd->check_esd_status_work);
-		mutex_unlock(&ipd->plat_mutex);
-	}
+	fr_latency_mark(LATENCY_HANDLER);
 
-	g_total_len = calc_packet_length();
+	/* the battery worker backs off by itself while touch is active */
+	WRITE_ONCE(ipd->last_touch_jiffies, jiffies);
+
+	g_total_len = g_fr_len_table[core_fr->actual_fw_mode];
 
 	if (g_total_len <= 0) {
 		ipio_err("Wrong the length of packet (%d)\n", g_total_len);
-		goto out;;
+		goto out;
 	}
 
-	g_fr_node = kmalloc(sizeof(*g_fr_node), GFP_ATOMIC);
-	if (ERR_ALLOC_MEM(g_fr_node)) {
-		ipio_err("Failed to allocate g_fr_node memory %ld\n", PTR_ERR(g_fr_node));
+	if (report == NULL) {
+		ipio_err("Can't find any callback functions to handle INT event\n");
 		goto out;
 	}
 
-	g_fr_node->data = kcalloc(g_total_len, sizeof(uint8_t), GFP_ATOMIC);
-	if (ERR_ALLOC_MEM(g_fr_node->data)) {
-		ipio_err("Failed to allocate g_fr_node memory %ld\n", PTR_ERR(g_fr_node->data));
-		goto out;
+	mutex_lock(&g_fr_pool.lock);
+
+	if (g_total_len > g_fr_pool.size) {
+		ipio_err("The length of packet (%d) is over frame pool (%d)\n",
+			g_total_len, g_fr_pool.size);
+		goto out_unlock;
 	}
 
+	g_fr_node = &g_fr_pool.node;
+	g_fr_node->data = g_fr_pool.frame;
 	g_fr_node->len = g_total_len;
 	memset(g_fr_node->data, 0xFF, (uint8_t) sizeof(uint8_t) * g_total_len);
 
-	while (i < ARRAY_SIZE(fr_t)) {
-		if (protocol->major == fr_t[i].protocol_marjor_ver) {
-			mutex_lock(&ipd->plat_mutex);
-			fr_t[i].finger_report();
-			mutex_unlock(&ipd->plat_mutex);
-
-			/* 2048 is referred to the defination by user */
-			if (g_total_len < 2048) {
-				tdata = kmalloc(g_total_len, GFP_ATOMIC);
-				if (ERR_ALLOC_MEM(tdata)) {
-					ipio_err("Failed to allocate g_fr_node memory %ld\n",
-						PTR_ERR(tdata));
-					goto out;
-				}
-
-				memcpy(tdata, g_fr_node->data, g_fr_node->len);
-				/* merge uart data if it's at i2cuart mode */
-				if (g_fr_uart != NULL)
-					memcpy(tdata + g_fr_node->len, g_fr_uart->data, g_fr_uart->len);
-			} else {
-				ipio_err("total length (%d) is too long than user can handle\n",
-					g_total_len);
-				goto out;
-			}
+	mutex_lock(&ipd->plat_mutex);
+	report();
+	mutex_unlock(&ipd->plat_mutex);
 
-			if (core_fr->isEnableNetlink)
-				netlink_reply_msg(tdata, g_total_len);
-
-			if (ipd->debug_node_open) {
-				mutex_lock(&ipd->ilitek_debug_mutex);
-				memset(ipd->debug_buf[ipd->debug_data_frame], 0x00,
-						(uint8_t) sizeof(uint8_t) * 2048);
-				memcpy(ipd->debug_buf[ipd->debug_data_frame], tdata, g_total_len);
-				ipd->debug_data_frame++;
-				if (ipd->debug_data_frame > 1) {
-					ipio_info("ipd->debug_data_frame = %d\n", ipd->debug_data_frame);
-				}
-				if (ipd->debug_data_frame > 1023) {
-					ipio_err("ipd->debug_data_frame = %d > 1024\n",
-						ipd->debug_data_frame);
-					ipd->debug_data_frame = 1023;
-				}
-				mutex_unlock(&ipd->ilitek_debug_mutex);
-				wake_up(&(ipd->inq));
-			}
+	if (g_total_len >= FR_USER_FRAME_SIZE) {
+		ipio_err("total length (%d) is too long than user can handle\n",
+			g_total_len);
+		goto out_unlock;
+	}
+
+	netlink_reply_msg(g_fr_node->data, g_total_len);
+
+	if (ipd->debug_node_open)
+		ilitek_debug_ring_push(g_fr_node->data, g_total_len);
+
+	ilitek_stream_push(g_fr_node->data, g_total_len);
+
+out_unlock:
+	g_fr_node = NULL;
+	mutex_unlock(&g_fr_pool.lock);
+
+out:
+	if (!core_bus->no_irq)
+		core_latency_commit();
+
+	ipio_debug(DEBUG_IRQ, "handle INT done\n\n");
+}
+EXPORT_SYMBOL(core_fr_handler);
+
+#ifdef FR_REPLAY
+static void fr_replay_save(struct fr_replay_saved *saved)
+{
+	saved->current_touch = g_current_touch;
+	saved->previous_touch = g_previous_touch;
+	memcpy(saved->last_point, g_last_point, sizeof(g_last_point));
+#ifdef MT_B_TYPE
+	saved->cadence_us = g_fr_coalesce.cadence_us;
+	saved->pending = g_fr_coalesce.pending;
+	saved->pending_touch = g_fr_coalesce.pending_touch;
+	saved->pending_data = g_fr_coalesce.pending_data;
+	saved->predict = g_fr_predict;
+#endif
+}
+
+static void fr_replay_load(struct fr_replay_saved *saved)
+{
+	g_current_touch = saved->current_touch;
+	g_previous_touch = saved->previous_touch;
+	memcpy(g_last_point, saved->last_point, sizeof(g_last_point));
+#ifdef MT_B_TYPE
+	g_fr_coalesce.cadence_us = saved->cadence_us;
+	g_fr_coalesce.pending = saved->pending;
+	g_fr_coalesce.pending_touch = saved->pending_touch;
+	g_fr_coalesce.pending_data = saved->pending_data;
+	g_fr_predict = saved->predict;
+#endif
+}
+
+/**
+ * Start replaying recorded packets through the parser. Input events are
+ * counted but not sent to system, and nothing is coalesced.
+ */
+int core_fr_replay_start(void)
+{
+	struct fr_replay *r = NULL;
+
+	if (protocol->major != 0x5) {
+		ipio_err("Replay only supports protocol 5.x, 0x%x\n", protocol->major);
+		return -EINVAL;
+	}
+
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (ERR_ALLOC_MEM(r)) {
+		ipio_err("Failed to allocate replay mem\n");
+		return -ENOMEM;
+	}
+
+	r->dummy = input_allocate_device();
+	if (ERR_ALLOC_MEM(r->dummy)) {
+		ipio_err("Failed to allocate replay input device\n");
+		kfree(r);
+		return -ENOMEM;
+	}
+
+#ifdef MT_B_TYPE
+	/* the error of prediction is measured on the trace alone */
+	mutex_lock(&g_fr_pool.lock);
+	r->replay.predict.horizon_us = g_fr_predict.horizon_us;
+	mutex_unlock(&g_fr_pool.lock);
+#endif
+
+	g_fr_replay = r;
+	return 0;
+}
+EXPORT_SYMBOL(core_fr_replay_start);
+
+/**
+ * Run a chunk of packets through the parser as fast as possible. The
+ * interrupt is only disabled while the chunk runs, and the live state is
+ * put back before it's enabled again.
+ *
+ * @trace: packets, each one is led by struct ilitek_debug_frame as what
+ *         debug_message gives in binary mode
+ * @size: the size of trace
+ *
+ * Returns how many bytes of whole packets were run, the rest of a packet
+ * cut at the end must be given again with the following data.
+ */
+int core_fr_replay_feed(uint8_t *trace, uint32_t size)
+{
+	int res = 0;
+	uint32_t pos = 0;
+	ktime_t start;
+	struct ilitek_debug_frame hdr;
+	struct input_dev *input = NULL;
+	struct core_fr_event_count events;
+	struct fr_replay *r = g_fr_replay;
+
+	if (r == NULL)
+		return -EINVAL;
+
+	ilitek_platform_disable_irq();
+	mutex_lock(&g_fr_pool.lock);
+
+	if (g_fr_pool.frame == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	fr_replay_save(&r->live);
+	fr_replay_load(&r->replay);
+	input = core_fr->input_device;
+	core_fr->input_device = r->dummy;
+	events = g_fr_events;
+	g_fr_replaying = true;
+
+	g_fr_node = &g_fr_pool.node;
+	g_fr_node->data = g_fr_pool.frame;
+
+	start = ktime_get();
+
+	while (pos + sizeof(hdr) <= size) {
+		memcpy(&hdr, trace + pos, sizeof(hdr));
+
+		if (hdr.len == 0 || hdr.len > g_fr_pool.size) {
+			ipio_err("Wrong packet in trace, len = %d\n", hdr.len);
+			res = -EINVAL;
 			break;
 		}
-		i++;
+
+		if (pos + sizeof(hdr) + hdr.len > size)
+			break;
+
+		pos += sizeof(hdr);
+		memcpy(g_fr_node->data, trace + pos, hdr.len);
+		g_fr_node->len = hdr.len;
+		g_total_len = hdr.len;
+		pos += hdr.len;
+
+		if (fr_process_ver_5_0(hdr.timestamp_ns) < 0)
+			r->stat.errors++;
+		r->stat.packets++;
 	}
 
-	if (i >= ARRAY_SIZE(fr_t))
-		ipio_err("Can't find any callback functions to handle INT event\n");
+	r->stat.elapsed_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	r->stat.events.press += g_fr_events.press - events.press;
+	r->stat.events.release += g_fr_events.release - events.release;
+	r->stat.events.move += g_fr_events.move - events.move;
+	r->stat.events.sync += g_fr_events.sync - events.sync;
+
+	g_fr_node = NULL;
+	g_fr_replaying = false;
+	core_fr->input_device = input;
+	fr_replay_save(&r->replay);
+	fr_replay_load(&r->live);
 
 out:
-	ipio_kfree((void **)&tdata);
+	mutex_unlock(&g_fr_pool.lock);
+	ilitek_platform_enable_irq();
+	return res < 0 ? res : pos;
+}
+EXPORT_SYMBOL(core_fr_replay_feed);
+
+/**
+ * Finish replaying and give the result.
+ *
+ * @stat: the number of packets, time spent and input events
+ */
+void core_fr_replay_stop(struct core_fr_replay_stat *stat)
+{
+	struct fr_replay *r = g_fr_replay;
+
+	if (r == NULL)
+		return;
+
+	*stat = r->stat;
+#ifdef MT_B_TYPE
+	stat->predict = r->replay.predict.stat;
+#endif
+
+	ipio_info("Replayed %d packets in %lldns, errors = %d\n",
+		stat->packets, (long long)stat->elapsed_ns, stat->errors);
 
-	if(g_fr_node != NULL) {
-		ipio_kfree((void **)&g_fr_node->data);
-		ipio_kfree((void **)&g_fr_node);
+	g_fr_replay = NULL;
+	input_free_device(r->dummy);
+	kfree(r);
+}
+EXPORT_SYMBOL(core_fr_replay_stop);
+#endif /* FR_REPLAY */
+
+/*
+ * Work out one row of the matrix for an axis on screen.
+ *
+ * @src: which axis on panel feeds it, 0 for X and 1 for Y
+ * @panel: the range of the axis on panel
+ * @screen: the range of the axis on screen
+ */
+static void fr_transform_row(int32_t *m, int src, uint32_t panel, uint32_t screen,
+				bool invert, int32_t offset)
+{
+	int32_t scale = (int32_t)div_u64((uint64_t)screen << 16, panel);
+
+	m[0] = (src == 0) ? scale : 0;
+	m[1] = (src == 1) ? scale : 0;
+	m[2] = offset * (1 << 16);
+
+	if (invert) {
+		m[0] = -m[0];
+		m[1] = -m[1];
+		m[2] += (int32_t)(screen - 1) * (1 << 16);
 	}
+}
+
+/*
+ * Precompute the matrix from settings of swap, invert, offset and the
+ * resolution. It is done once the settings are changed rather than
+ * for every point.
+ */
+void core_fr_update_transform(void)
+{
+	struct fr_transform t;
+	uint32_t panel_x, panel_y, screen_x, screen_y;
 
-	if(g_fr_uart != NULL) {
-		ipio_kfree((void **)&g_fr_uart->data);
-		ipio_kfree((void **)&g_fr_uart);
+	if (core_fr->isSetResolution && !ERR_ALLOC_MEM(core_config->tp_info)) {
+		panel_x = screen_x = core_config->tp_info->nMaxX;
+		panel_y = screen_y = core_config->tp_info->nMaxY;
+	} else {
+		panel_x = TPD_WIDTH;
+		panel_y = TPD_HEIGHT;
+		screen_x = core_fr->screen_x;
+		screen_y = core_fr->screen_y;
 	}
 
-	if (ipd->isEnablePollCheckPower) {
-		mutex_lock(&ipd->plat_mutex);
-		queue_delayed_work(ipd->check_power_status_queue,
-				&ipd->check_power_status_work, ipd->work_delay);
-		mutex_unlock(&ipd->plat_mutex);
+	if (panel_x == 0 || panel_y == 0 || screen_x == 0 || screen_y == 0) {
+		ipio_err("Invalid resolution, panel = %dx%d, screen = %dx%d\n",
+			panel_x, panel_y, screen_x, screen_y);
+		return;
 	}
 
-	if (ipd->isEnablePollCheckEsd) {
-		mutex_lock(&ipd->plat_mutex);
-		queue_delayed_work(ipd->check_power_status_queue,
-				&ipd->check_power_status_work, ipd->work_delay);
-		mutex_unlock(&ipd->plat_mutex);
+	if (core_fr->isSwapXY) {
+		fr_transform_row(t.mx, 1, panel_y, screen_x, core_fr->isInvertX, core_fr->offset_x);
+		fr_transform_row(t.my, 0, panel_x, screen_y, core_fr->isInvertY, core_fr->offset_y);
+	} else {
+		fr_transform_row(t.mx, 0, panel_x, screen_x, core_fr->isInvertX, core_fr->offset_x);
+		fr_transform_row(t.my, 1, panel_y, screen_y, core_fr->isInvertY, core_fr->offset_y);
 	}
 
-	ipio_debug(DEBUG_IRQ, "handle INT done\n\n");
+	t.max_x = screen_x - 1;
+	t.max_y = screen_y - 1;
+
+	mutex_lock(&g_fr_pool.lock);
+	g_fr_transform = t;
+	mutex_unlock(&g_fr_pool.lock);
+
+	ipio_info("transform: swap = %d, invert = %d/%d, offset = %d/%d, panel = %dx%d, screen = %dx%d\n",
+		core_fr->isSwapXY, core_fr->isInvertX, core_fr->isInvertY,
+		core_fr->offset_x, core_fr->offset_y, panel_x, panel_y, screen_x, screen_y);
 }
-EXPORT_SYMBOL(core_fr_handler);
+EXPORT_SYMBOL(core_fr_update_transform);
 
 void core_fr_input_set_param(struct input_dev *input_device)
 {
@@ -801,8 +1746,8 @@ void core_fr_input_set_param(struct input_dev *input_device)
 		min_y = core_config->tp_info->nMinY;
 		max_tp = core_config->tp_info->nMaxTouchNum;
 	} else {
-		max_x = TOUCH_SCREEN_X_MAX;
-		max_y = TOUCH_SCREEN_Y_MAX;
+		max_x = core_fr->screen_x;
+		max_y = core_fr->screen_y;
 		min_x = TOUCH_SCREEN_X_MIN;
 		min_y = TOUCH_SCREEN_Y_MIN;
 		max_tp = MAX_TOUCH_NUM;
@@ -830,6 +1775,8 @@ void core_fr_input_set_param(struct input_dev *input_device)
 	input_set_abs_params(core_fr->input_device, ABS_MT_TRACKING_ID, 0, max_tp, 0, 0);
 #endif /* MT_B_TYPE */
 
+	core_fr_update_transform();
+
 	/* Set up virtual key with gesture code */
 	core_gesture_set_key(core_fr);
 }
@@ -845,14 +1792,27 @@ int core_fr_init(void)
 		return -ENOMEM;
 	}
 
+	mutex_init(&g_fr_pool.lock);
+	g_fr_pool.frame = NULL;
+	g_fr_pool.size = 0;
+
+#ifdef MT_B_TYPE
+	hrtimer_init(&g_fr_coalesce.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	g_fr_coalesce.timer.function = fr_coalesce_timer;
+	INIT_WORK(&g_fr_coalesce.flush, fr_coalesce_flush);
+#endif
+
 	for (i = 0; i < ARRAY_SIZE(ipio_chip_list); i++) {
 		if (ipio_chip_list[i] == TP_TOUCH_IC) {
 			core_fr->isEnableFR = true;
 			core_fr->isEnableNetlink = false;
 			core_fr->isEnablePressure = false;
 			core_fr->isSetResolution = false;
+			core_fr->screen_x = TOUCH_SCREEN_X_MAX;
+			core_fr->screen_y = TOUCH_SCREEN_Y_MAX;
 			core_fr->actual_fw_mode = protocol->demo_mode;
-			return 0;
+			core_fr_update_report();
+			return core_fr_update_len_table();
 		}
 	}
 
@@ -860,3 +1820,20 @@ int core_fr_init(void)
 	return 0;
 }
 EXPORT_SYMBOL(core_fr_init);
+
+void core_fr_remove(void)
+{
+	ipio_info("Remove core-fr members\n");
+
+#ifdef MT_B_TYPE
+	hrtimer_cancel(&g_fr_coalesce.timer);
+	cancel_work_sync(&g_fr_coalesce.flush);
+#endif
+
+	mutex_lock(&g_fr_pool.lock);
+	core_i2c_dma_free(g_fr_pool.frame);
+	g_fr_pool.frame = NULL;
+	g_fr_pool.size = 0;
+	mutex_unlock(&g_fr_pool.lock);
+}
+EXPORT_SYMBOL(core_fr_remove);
@@ -36,6 +36,15 @@ struct core_fr_data {
 	bool isEnablePressure;
 	/* get screen resloution from fw if it's true */
 	bool isSetResolution;
+
+	/* transform the coordinate from panel to screen */
+	bool isSwapXY;
+	bool isInvertX;
+	bool isInvertY;
+	int32_t offset_x;
+	int32_t offset_y;
+	uint32_t screen_x;
+	uint32_t screen_y;
 	/* used to change I2C Uart Mode when fw mode is in this mode */
 	uint8_t i2cuart_mode;
 
@@ -54,12 +63,79 @@ struct core_fr_data {
 
 extern struct core_fr_data *core_fr;
 
+/* input events sent by the parser */
+struct core_fr_event_count {
+	uint32_t press;
+	uint32_t release;
+	uint32_t move;
+	uint32_t sync;
+};
+
+/* frames parsed, merged into a pending one and reported late by coalescing */
+struct core_fr_coalesce_stat {
+	uint32_t frames;
+	uint32_t merged;
+	uint32_t flushed;
+};
+
+/* how far predicted points were from the real ones, in pixels */
+struct core_fr_predict_stat {
+	uint32_t samples;
+	uint32_t err_max;
+	uint64_t err_sum;
+};
+
+/* The result of replaying a trace of packets through the parser */
+struct core_fr_replay_stat {
+	uint32_t packets;
+	uint32_t errors;
+	uint64_t elapsed_ns;
+	struct core_fr_event_count events;
+	/* the error of prediction on the trace alone */
+	struct core_fr_predict_stat predict;
+};
+
+/* The checksum of packets, accumulated as data comes in */
+struct core_fr_checksum {
+	uint32_t sum;
+};
+
+static inline void core_fr_checksum_init(struct core_fr_checksum *csum)
+{
+	csum->sum = 0;
+}
+
+static inline uint8_t core_fr_checksum_final(struct core_fr_checksum *csum)
+{
+	return (uint8_t) ((-csum->sum) & 0xFF);
+}
+
+extern void core_fr_checksum_update(struct core_fr_checksum *csum, const uint8_t *buf, uint32_t len);
 extern uint8_t core_fr_calc_checksum(uint8_t *pMsg, uint32_t nLength);
+#ifdef CHECKSUM_BENCH
+extern int core_fr_checksum_bench(int loops, uint64_t *ref_ns, uint64_t *fast_ns);
+#endif
+extern int core_fr_i2cuart_data_len(uint8_t *data);
 extern void core_fr_touch_press(int32_t x, int32_t y, uint32_t pressure, int32_t id);
 extern void core_fr_touch_release(int32_t x, int32_t y, int32_t id);
+extern void core_fr_touch_release_all(void);
 extern int core_fr_mode_control(uint8_t *from_user);
+extern int core_fr_update_len_table(void);
+extern void core_fr_update_report(void);
 extern void core_fr_handler(void);
+extern void core_fr_vsync(void);
+extern int core_fr_set_coalesce(uint32_t cadence_us);
+extern void core_fr_get_coalesce(uint32_t *cadence_us, struct core_fr_coalesce_stat *stat);
+extern int core_fr_set_predict(uint32_t horizon_ms);
+extern void core_fr_get_predict(uint32_t *horizon_ms, struct core_fr_predict_stat *stat);
+#ifdef FR_REPLAY
+extern int core_fr_replay_start(void);
+extern int core_fr_replay_feed(uint8_t *trace, uint32_t size);
+extern void core_fr_replay_stop(struct core_fr_replay_stat *stat);
+#endif
 extern void core_fr_input_set_param(struct input_dev *input_device);
+extern void core_fr_update_transform(void);
 extern int core_fr_init(void);
+extern void core_fr_remove(void);
 
 #endif /* __FINGER_REPORT_H */
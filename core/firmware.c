@@ -51,6 +51,7 @@
 #define NEED_UPDATE	   1
 #define NO_NEED_UPDATE 0
 #define FW_VER_ADDR	   0xFFE0
+#define FW_PAGE_BUF_SIZE   512
 #define CRC_ONESET(X, Y)	({Y = (*(X+0) << 24) | (*(X+1) << 16) | (*(X+2) << 8) | (*(X+3));})
 
 /*
@@ -145,6 +146,7 @@ static uint32_t tddi_check_data(uint32_t start_addr, uint32_t end_addr)
 	uint32_t iram_check = 0;
 	uint32_t id = core_config->chip_id;
 	uint32_t type = core_config->chip_type;
+	struct core_ice_queue q;
 
 	write_len = end_addr;
 
@@ -157,37 +159,41 @@ static uint32_t tddi_check_data(uint32_t start_addr, uint32_t end_addr)
 		goto out;
 	}
 
-	core_config_ice_mode_write(0x041000, 0x0, 1);	/* CS low */
-	core_config_ice_mode_write(0x041004, 0x66aa55, 3);	/* Key */
+	core_config_ice_queue_init(&q);
+	core_config_ice_queue_write(&q, 0x041000, 0x0, 1);	/* CS low */
+	core_config_ice_queue_write(&q, 0x041004, 0x66aa55, 3);	/* Key */
 
-	core_config_ice_mode_write(0x041008, 0x3b, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0xFF0000) >> 16, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0x00FF00) >> 8, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0x0000FF), 1);
+	core_config_ice_queue_write(&q, 0x041008, 0x3b, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0xFF0000) >> 16, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0x00FF00) >> 8, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0x0000FF), 1);
 
-	core_config_ice_mode_write(0x041003, 0x01, 1);	/* Enable Dio_Rx_dual */
-	core_config_ice_mode_write(0x041008, 0xFF, 1);	/* Dummy */
+	core_config_ice_queue_write(&q, 0x041003, 0x01, 1);	/* Enable Dio_Rx_dual */
+	core_config_ice_queue_write(&q, 0x041008, 0xFF, 1);	/* Dummy */
 
 	/* Set Receive count */
 	if (core_firmware->max_count == 0xFFFF)
-		core_config_ice_mode_write(0x04100C, write_len, 2);
+		core_config_ice_queue_write(&q, 0x04100C, write_len, 2);
 	else if (core_firmware->max_count == 0x1FFFF)
-		core_config_ice_mode_write(0x04100C, write_len, 3);
+		core_config_ice_queue_write(&q, 0x04100C, write_len, 3);
 
 	if (id == CHIP_TYPE_ILI9881 && type == ILI9881_TYPE_F) {
 		/* Checksum_En */
-		core_config_ice_mode_write(0x041014, 0x10000, 3);
+		core_config_ice_queue_write(&q, 0x041014, 0x10000, 3);
 	} else if (id == CHIP_TYPE_ILI9881 && type == ILI9881_TYPE_H) {
 		/* Clear Int Flag */
-		core_config_ice_mode_write(0x048007, 0x02, 1);
+		core_config_ice_queue_write(&q, 0x048007, 0x02, 1);
 
 		/* Checksum_En */
-		core_config_ice_mode_write(0x041016, 0x00, 1);
-		core_config_ice_mode_write(0x041016, 0x01, 1);
+		core_config_ice_queue_write(&q, 0x041016, 0x00, 1);
+		core_config_ice_queue_write(&q, 0x041016, 0x01, 1);
 	}
 
 	/* Start to receive */
-	core_config_ice_mode_write(0x041010, 0xFF, 1);
+	core_config_ice_queue_write(&q, 0x041010, 0xFF, 1);
+
+	if (core_config_ice_queue_submit(&q) < 0)
+		goto out;
 
 	while (timer > 0) {
 
@@ -209,17 +215,24 @@ static uint32_t tddi_check_data(uint32_t start_addr, uint32_t end_addr)
 		timer--;
 	}
 
-	core_config_ice_mode_write(0x041000, 0x1, 1);	/* CS high */
+	core_config_ice_queue_write(&q, 0x041000, 0x1, 1);	/* CS high */
 
 	if (timer >= 0) {
 		/* Disable dio_Rx_dual */
-		core_config_ice_mode_write(0x041003, 0x0, 1);
-		iram_check =  core_firmware->isCRC ? core_config_ice_mode_read(0x4101C) : core_config_ice_mode_read(0x041018);
-	} else {
+		core_config_ice_queue_write(&q, 0x041003, 0x0, 1);
+		core_config_ice_queue_read(&q, core_firmware->isCRC ? 0x4101C : 0x041018, 4);
+	}
+
+	if (core_config_ice_queue_submit(&q) < 0)
+		goto out;
+
+	if (timer < 0) {
 		ipio_err("TIME OUT\n");
 		goto out;
 	}
 
+	iram_check = q.rdata[0];
+
 	return iram_check;
 
 out:
@@ -435,19 +448,21 @@ static int do_program_flash(uint32_t start_addr)
 {
 	int res = 0;
 	uint32_t k;
-	uint8_t buf[512] = { 0 };
+	uint8_t *buf = core_firmware->page_buf;
+	struct core_ice_queue q;
 
 	res = core_flash_write_enable();
 	if (res < 0)
 		goto out;
 
-	core_config_ice_mode_write(0x041000, 0x0, 1);	/* CS low */
-	core_config_ice_mode_write(0x041004, 0x66aa55, 3);	/* Key */
+	core_config_ice_queue_init(&q);
+	core_config_ice_queue_write(&q, 0x041000, 0x0, 1);	/* CS low */
+	core_config_ice_queue_write(&q, 0x041004, 0x66aa55, 3);	/* Key */
 
-	core_config_ice_mode_write(0x041008, 0x02, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0xFF0000) >> 16, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0x00FF00) >> 8, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0x0000FF), 1);
+	core_config_ice_queue_write(&q, 0x041008, 0x02, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0xFF0000) >> 16, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0x00FF00) >> 8, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0x0000FF), 1);
 
 	buf[0] = 0x25;
 	buf[3] = 0x04;
@@ -461,15 +476,16 @@ static int do_program_flash(uint32_t start_addr)
 			buf[4 + k] = 0xFF;
 	}
 
-	if (core_write(core_config->slave_i2c_addr, buf, flashtab->program_page + 4) < 0) {
+	core_config_ice_queue_write_buf(&q, buf, flashtab->program_page + 4);
+	core_config_ice_queue_write(&q, 0x041000, 0x1, 1);	/* CS high */
+
+	if (core_config_ice_queue_submit(&q) < 0) {
 		ipio_err("Failed to write data at start_addr = 0x%X, k = 0x%X, addr = 0x%x\n",
 			start_addr, k, start_addr + k);
 		res = -EIO;
 		goto out;
 	}
 
-	core_config_ice_mode_write(0x041000, 0x1, 1);	/* CS high */
-
 	res = core_flash_poll_busy();
 	if (res < 0)
 		goto out;
@@ -524,6 +540,7 @@ static int do_erase_flash(uint32_t start_addr)
 {
 	int res = 0;
 	uint32_t temp_buf = 0;
+	struct core_ice_queue q;
 
 	res = core_flash_write_enable();
 	if (res < 0) {
@@ -531,15 +548,20 @@ static int do_erase_flash(uint32_t start_addr)
 		goto out;
 	}
 
-	core_config_ice_mode_write(0x041000, 0x0, 1);	/* CS low */
-	core_config_ice_mode_write(0x041004, 0x66aa55, 3);	/* Key */
+	core_config_ice_queue_init(&q);
+	core_config_ice_queue_write(&q, 0x041000, 0x0, 1);	/* CS low */
+	core_config_ice_queue_write(&q, 0x041004, 0x66aa55, 3);	/* Key */
 
-	core_config_ice_mode_write(0x041008, 0x20, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0xFF0000) >> 16, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0x00FF00) >> 8, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0x0000FF), 1);
+	core_config_ice_queue_write(&q, 0x041008, 0x20, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0xFF0000) >> 16, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0x00FF00) >> 8, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0x0000FF), 1);
 
-	core_config_ice_mode_write(0x041000, 0x1, 1);	/* CS high */
+	core_config_ice_queue_write(&q, 0x041000, 0x1, 1);	/* CS high */
+
+	res = core_config_ice_queue_submit(&q);
+	if (res < 0)
+		goto out;
 
 	mdelay(1);
 
@@ -547,24 +569,30 @@ static int do_erase_flash(uint32_t start_addr)
 	if (res < 0)
 		goto out;
 
-	core_config_ice_mode_write(0x041000, 0x0, 1);	/* CS low */
-	core_config_ice_mode_write(0x041004, 0x66aa55, 3);	/* Key */
+	/* Read the first byte back, which must be blank after erasing */
+	core_config_ice_queue_write(&q, 0x041000, 0x0, 1);	/* CS low */
+	core_config_ice_queue_write(&q, 0x041004, 0x66aa55, 3);	/* Key */
 
-	core_config_ice_mode_write(0x041008, 0x3, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0xFF0000) >> 16, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0x00FF00) >> 8, 1);
-	core_config_ice_mode_write(0x041008, (start_addr & 0x0000FF), 1);
-	core_config_ice_mode_write(0x041008, 0xFF, 1);
+	core_config_ice_queue_write(&q, 0x041008, 0x3, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0xFF0000) >> 16, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0x00FF00) >> 8, 1);
+	core_config_ice_queue_write(&q, 0x041008, (start_addr & 0x0000FF), 1);
+	core_config_ice_queue_write(&q, 0x041008, 0xFF, 1);
 
-	temp_buf = core_config_read_write_onebyte(0x041010);
+	core_config_ice_queue_read(&q, 0x041010, 1);
+	core_config_ice_queue_write(&q, 0x041000, 0x1, 1);	/* CS high */
+
+	res = core_config_ice_queue_submit(&q);
+	if (res < 0)
+		goto out;
+
+	temp_buf = q.rdata[0] & 0xFF;
 	if (temp_buf != 0xFF) {
 		ipio_err("Failed to erase data(0x%x) at 0x%x\n", temp_buf, start_addr);
 		res = -EINVAL;
 		goto out;
 	}
 
-	core_config_ice_mode_write(0x041000, 0x1, 1);	/* CS high */
-
 	ipio_debug(DEBUG_FIRMWARE, "Earsing data at start addr: %x\n", start_addr);
 
 out:
@@ -596,7 +624,7 @@ out:
 static int iram_upgrade(void)
 {
 	int i, j, res = 0;
-	uint8_t buf[512];
+	uint8_t *buf = core_firmware->page_buf;
 	int upl = flashtab->program_page;
 
 	/* doing reset for erasing iram data before upgrade it. */
@@ -1297,6 +1325,12 @@ int core_firmware_init(void)
 	core_firmware->hasBlockInfo = false;
 	core_firmware->isboot = false;
 
+	core_firmware->page_buf = core_i2c_dma_alloc(FW_PAGE_BUF_SIZE);
+	if (ERR_ALLOC_MEM(core_firmware->page_buf)) {
+		ipio_err("Failed to allocate page buf, %ld\n", PTR_ERR(core_firmware->page_buf));
+		return -ENOMEM;
+	}
+
 	for (; i < ARRAY_SIZE(ipio_chip_list); i++) {
 		if (ipio_chip_list[i] == TP_TOUCH_IC) {
 			for (j = 0; j < 4; j++) {
@@ -1317,3 +1351,14 @@ int core_firmware_init(void)
 	ipio_err("Can't find this chip in support list\n");
 	return 0;
 }
+
+void core_firmware_remove(void)
+{
+	ipio_info("Remove core-firmware members\n");
+
+	if (core_firmware == NULL)
+		return;
+
+	core_i2c_dma_free(core_firmware->page_buf);
+	core_firmware->page_buf = NULL;
+}
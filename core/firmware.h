@@ -41,6 +41,9 @@ struct core_firmware_data {
 
 	int delay_after_upgrade;
 
+	/* a page with its ICE cmd, being written to IRAM or flash */
+	uint8_t *page_buf;
+
 	bool isUpgrading;
 	bool isCRC;
 	bool isboot;
@@ -58,5 +61,6 @@ extern int tddi_fw_upgrade(bool isIRAM);
 /* extern int core_firmware_iram_upgrade(const char* fpath); */
 extern int core_firmware_upgrade(const char *, bool isIRAM);
 extern int core_firmware_init(void);
+extern void core_firmware_remove(void);
 
 #endif /* __FIRMWARE_H */
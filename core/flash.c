@@ -49,17 +49,29 @@ struct flash_table *flashtab = NULL;
 int core_flash_poll_busy(void)
 {
 	int timer = 500, res = 0;
+	struct core_ice_queue q;
 
-	core_config_ice_mode_write(0x041000, 0x0, 1);	/* CS low */
-	core_config_ice_mode_write(0x041004, 0x66aa55, 3);	/* Key */
+	core_config_ice_queue_init(&q);
+	core_config_ice_queue_write(&q, 0x041000, 0x0, 1);	/* CS low */
+	core_config_ice_queue_write(&q, 0x041004, 0x66aa55, 3);	/* Key */
+	core_config_ice_queue_write(&q, 0x041008, 0x5, 1);
 
-	core_config_ice_mode_write(0x041008, 0x5, 1);
+	/* The command of status is sent along with the first dummy clock */
 	while (timer > 0) {
-		core_config_ice_mode_write(0x041008, 0xFF, 1);
+		core_config_ice_queue_write(&q, 0x041008, 0xFF, 1);
+		res = core_config_ice_queue_submit(&q);
+		if (res < 0)
+			goto out;
 
-		mdelay(1);
+		/* Give flash the same 1ms as before to shift its status out */
+		usleep_range(1000, 1200);
+
+		core_config_ice_queue_read(&q, 0x041010, 1);
+		res = core_config_ice_queue_submit(&q);
+		if (res < 0)
+			goto out;
 
-		if ((core_config_read_write_onebyte(0x041010) & 0x03) == 0x00)
+		if ((q.rdata[0] & 0x03) == 0x00)
 			goto out;
 
 		timer--;
@@ -75,20 +87,20 @@ EXPORT_SYMBOL(core_flash_poll_busy);
 
 int core_flash_write_enable(void)
 {
-	if (core_config_ice_mode_write(0x041000, 0x0, 1) < 0)
-		goto out;
-	if (core_config_ice_mode_write(0x041004, 0x66aa55, 3) < 0)
-		goto out;
-	if (core_config_ice_mode_write(0x041008, 0x6, 1) < 0)
-		goto out;
-	if (core_config_ice_mode_write(0x041000, 0x1, 1) < 0)
-		goto out;
+	struct core_ice_queue q;
 
-	return 0;
+	core_config_ice_queue_init(&q);
+	core_config_ice_queue_write(&q, 0x041000, 0x0, 1);	/* CS low */
+	core_config_ice_queue_write(&q, 0x041004, 0x66aa55, 3);	/* Key */
+	core_config_ice_queue_write(&q, 0x041008, 0x6, 1);
+	core_config_ice_queue_write(&q, 0x041000, 0x1, 1);	/* CS high */
 
-out:
-	ipio_err("Write enable failed !\n");
-	return -EIO;
+	if (core_config_ice_queue_submit(&q) < 0) {
+		ipio_err("Write enable failed !\n");
+		return -EIO;
+	}
+
+	return 0;
 }
 EXPORT_SYMBOL(core_flash_write_enable);
 
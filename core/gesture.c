@@ -143,6 +143,10 @@ int core_gesture_init(void)
 
 	core_gesture->entry = false;
 
+	/* The length of gesture packets depends on its mode */
+	if (core_fr != NULL)
+		return core_fr_update_len_table();
+
 	return 0;
 }
 EXPORT_SYMBOL(core_gesture_init);
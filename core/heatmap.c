@@ -0,0 +1,200 @@
+/*
+ * ILITEK Touch IC driver
+ *
+ * Copyright (C) 2011 ILI Technology Corporation.
+ *
+ * Author: Dicky Chiang <dicky_chiang@ilitek.com>
+ * Based on TDD v7.0 implemented by Mstar & ILITEK
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+
+#include "../common.h"
+#include "../platform.h"
+#include "config.h"
+#include "heatmap.h"
+
+/* FIXME: self_key not defined by firmware yet, the same as calc_packet_length() */
+#define HEATMAP_SELF_KEY	2
+
+/*
+ * Packets are decoded into the back frame by the irq path only, which then
+ * swaps it with the front frame under the lock. Readers copy the front one
+ * holding the lock, and the irq path would rather drop a frame than wait.
+ */
+struct core_heatmap_data {
+	struct mutex lock;
+	struct core_heatmap_frame frame[2];
+	int front;
+	uint32_t seq;
+	uint32_t dropped;
+	atomic_t users;
+	wait_queue_head_t wq;
+};
+
+static struct core_heatmap_data *core_heatmap = NULL;
+
+/* Kept as a plain loop with no branches so compilers are able to vectorise it */
+void core_heatmap_decode_be16(int16_t *dst, const uint8_t *src, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++)
+		dst[i] = (int16_t)((src[2 * i] << 8) | src[2 * i + 1]);
+}
+EXPORT_SYMBOL(core_heatmap_decode_be16);
+
+/**
+ * Decode the mutual, self and key data of a debug packet and publish them
+ * to readers. It does nothing unless the heatmap is opened by someone.
+ *
+ * @data: a whole debug packet
+ * @len: the length of packet
+ */
+void core_heatmap_decode(uint8_t *data, uint16_t len)
+{
+	int xch, ych, stx, srx, num;
+	struct core_heatmap_frame *back = NULL;
+
+	if (core_heatmap == NULL || atomic_read(&core_heatmap->users) == 0)
+		return;
+
+	if (ERR_ALLOC_MEM(core_config->tp_info))
+		return;
+
+	xch = core_config->tp_info->nXChannelNum;
+	ych = core_config->tp_info->nYChannelNum;
+	stx = core_config->tp_info->self_tx_channel_num;
+	srx = core_config->tp_info->self_rx_channel_num;
+	num = xch * ych + stx + srx + HEATMAP_SELF_KEY;
+
+	if (num > HEATMAP_VALUE_MAX || HEATMAP_DATA_OFFSET + num * 2 > len) {
+		ipio_err("Wrong size of heatmap, x = %d, y = %d, len = %d\n", xch, ych, len);
+		return;
+	}
+
+	back = &core_heatmap->frame[!core_heatmap->front];
+	core_heatmap_decode_be16(back->data, data + HEATMAP_DATA_OFFSET, num);
+
+	back->x_ch = xch;
+	back->y_ch = ych;
+	back->self_tx = stx;
+	back->self_rx = srx;
+	back->key_num = HEATMAP_SELF_KEY;
+	back->value_num = num;
+	back->timestamp_ns = ktime_to_ns(ktime_get());
+
+	if (!mutex_trylock(&core_heatmap->lock)) {
+		core_heatmap->dropped++;
+		return;
+	}
+
+	back->seq = core_heatmap->seq + 1;
+	back->dropped = core_heatmap->dropped;
+	core_heatmap->front = !core_heatmap->front;
+	WRITE_ONCE(core_heatmap->seq, back->seq);
+	mutex_unlock(&core_heatmap->lock);
+
+	wake_up_interruptible(&core_heatmap->wq);
+}
+EXPORT_SYMBOL(core_heatmap_decode);
+
+int core_heatmap_open(void)
+{
+	if (core_heatmap == NULL)
+		return -ENODEV;
+
+	atomic_inc(&core_heatmap->users);
+	return 0;
+}
+EXPORT_SYMBOL(core_heatmap_open);
+
+void core_heatmap_release(void)
+{
+	if (core_heatmap != NULL)
+		atomic_dec(&core_heatmap->users);
+}
+EXPORT_SYMBOL(core_heatmap_release);
+
+/**
+ * Copy the latest frame to users, waiting for it unless nonblock is set
+ * if it's the same one as read last time.
+ *
+ * @buff: user buffer, it must hold the header and values of the frame
+ * @size: the size of user buffer
+ * @last_seq: seq of the frame read last time by the caller, updated
+ * @nonblock: don't wait for a new frame
+ */
+ssize_t core_heatmap_read(char __user *buff, size_t size, uint32_t *last_seq, bool nonblock)
+{
+	ssize_t res = 0;
+	size_t len = 0;
+	struct core_heatmap_frame *front = NULL;
+
+	if (core_heatmap == NULL)
+		return -ENODEV;
+
+	if (READ_ONCE(core_heatmap->seq) == *last_seq) {
+		if (nonblock)
+			return -EAGAIN;
+		if (wait_event_interruptible(core_heatmap->wq, READ_ONCE(core_heatmap->seq) != *last_seq))
+			return -ERESTARTSYS;
+	}
+
+	mutex_lock(&core_heatmap->lock);
+
+	front = &core_heatmap->frame[core_heatmap->front];
+	len = offsetof(struct core_heatmap_frame, data) + front->value_num * sizeof(int16_t);
+
+	if (size < len) {
+		ipio_err("The size of buffer (%d) is less than the frame (%d)\n", (int)size, (int)len);
+		res = -EINVAL;
+		goto out;
+	}
+
+	if (copy_to_user(buff, front, len)) {
+		ipio_err("Failed to copy data to user space\n");
+		res = -EFAULT;
+		goto out;
+	}
+
+	*last_seq = front->seq;
+	res = len;
+
+out:
+	mutex_unlock(&core_heatmap->lock);
+	return res;
+}
+EXPORT_SYMBOL(core_heatmap_read);
+
+int core_heatmap_init(void)
+{
+	core_heatmap = devm_kzalloc(ipd->dev, sizeof(*core_heatmap), GFP_KERNEL);
+	if (ERR_ALLOC_MEM(core_heatmap)) {
+		ipio_err("Failed to allocate core_heatmap mem, %ld\n", PTR_ERR(core_heatmap));
+		core_heatmap = NULL;
+		return -ENOMEM;
+	}
+
+	mutex_init(&core_heatmap->lock);
+	atomic_set(&core_heatmap->users, 0);
+	init_waitqueue_head(&core_heatmap->wq);
+
+	return 0;
+}
+EXPORT_SYMBOL(core_heatmap_init);
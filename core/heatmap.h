@@ -0,0 +1,59 @@
+/*
+ * ILITEK Touch IC driver
+ *
+ * Copyright (C) 2011 ILI Technology Corporation.
+ *
+ * Author: Dicky Chiang <dicky_chiang@ilitek.com>
+ * Based on TDD v7.0 implemented by Mstar & ILITEK
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef __HEATMAP_H
+#define __HEATMAP_H
+
+/* Mutual data starts after the header and points of a debug packet */
+#define HEATMAP_DATA_OFFSET	35
+
+/* Values are bounded by the frame pool which a debug packet must fit in */
+#define HEATMAP_VALUE_MAX	1024
+
+/*
+ * A debug packet decoded into planes of int16, read from /proc/ilitek/heatmap
+ * as it is, up to data[value_num]. data[] holds mutual[y_ch][x_ch] first,
+ * followed by self_tx, self_rx and key_num values.
+ */
+struct core_heatmap_frame {
+	uint32_t seq;
+	uint8_t x_ch;
+	uint8_t y_ch;
+	uint8_t self_tx;
+	uint8_t self_rx;
+	uint16_t key_num;
+	uint16_t value_num;
+	uint32_t dropped;
+	uint64_t timestamp_ns;
+	int16_t data[HEATMAP_VALUE_MAX];
+};
+
+extern void core_heatmap_decode_be16(int16_t *dst, const uint8_t *src, int num);
+extern void core_heatmap_decode(uint8_t *data, uint16_t len);
+extern int core_heatmap_open(void);
+extern void core_heatmap_release(void);
+extern ssize_t core_heatmap_read(char __user *buff, size_t size, uint32_t *last_seq, bool nonblock);
+extern int core_heatmap_init(void);
+
+#endif
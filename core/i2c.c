@@ -32,6 +32,9 @@
 
 struct core_i2c_data *core_i2c;
 
+/* Commands of MP test are the longest written with a checksum appended */
+#define I2C_TXBUF_SIZE	P5_0_DEBUG_MODE_PACKET_LENGTH
+
 #ifdef I2C_DMA
 static unsigned char *ilitek_dma_va = NULL;
 static dma_addr_t ilitek_dma_pa = 0;
@@ -58,11 +61,197 @@ static int dma_alloc(struct core_i2c_data *i2c)
 }
 #endif /* I2C_DMA */
 
+#ifdef I2C_DMA_SAFE
+/*
+ * Slots to bounce messages whose buffers might not be dma-safe, e.g. on stack.
+ * A slot is able to hold a packet of debug mode or a flash page with its cmd.
+ */
+#define I2C_DMA_POOL_NUM	4
+#define I2C_DMA_THRESHOLD	32
+
+/* Buffers from core_i2c_dma_alloc(), which are sent without a bounce */
+#define I2C_DMA_REGION_NUM	8
+
+struct i2c_dma_region {
+	uint8_t *buf;
+	size_t size;
+};
+
+static struct i2c_dma_region i2c_dma_region[I2C_DMA_REGION_NUM];
+static DEFINE_SPINLOCK(i2c_dma_lock);
+
+static bool i2c_dma_is_safe(uint8_t *buf, uint16_t len)
+{
+	int i;
+	bool safe = false;
+
+	spin_lock(&i2c_dma_lock);
+	for (i = 0; i < I2C_DMA_REGION_NUM; i++) {
+		if (buf >= i2c_dma_region[i].buf &&
+		    buf + len <= i2c_dma_region[i].buf + i2c_dma_region[i].size) {
+			safe = true;
+			break;
+		}
+	}
+	spin_unlock(&i2c_dma_lock);
+
+	return safe;
+}
+
+static uint8_t *i2c_dma_get_slot(uint16_t len)
+{
+	int i;
+
+	if (core_i2c->dma_pool == NULL || len > core_i2c->dma_slot_size)
+		return NULL;
+
+	for (i = 0; i < I2C_DMA_POOL_NUM; i++) {
+		if (!test_and_set_bit_lock(i, &core_i2c->dma_slot_map))
+			return core_i2c->dma_pool + i * core_i2c->dma_slot_size;
+	}
+
+	return NULL;
+}
+
+static bool i2c_dma_is_slot(uint8_t *buf)
+{
+	return buf >= core_i2c->dma_pool &&
+	       buf < core_i2c->dma_pool + I2C_DMA_POOL_NUM * core_i2c->dma_slot_size;
+}
+
+static void i2c_dma_put_slot(uint8_t *slot)
+{
+	clear_bit_unlock((slot - core_i2c->dma_pool) / core_i2c->dma_slot_size, &core_i2c->dma_slot_map);
+}
+
+/*
+ * Messages not shorter than dma_threshold are flagged with I2C_M_DMA_SAFE, so
+ * the adapter maps them as they are instead of bouncing by itself. Buffers from
+ * core_i2c_dma_alloc() are sent directly, others are copied to a slot of pool,
+ * or to the one given by i2c core if all of slots are in use.
+ */
+static int i2c_dma_transfer(struct i2c_msg *msgs, int num)
+{
+	int i, res;
+	uint8_t *bounce = NULL;
+	uint8_t *orig[ICE_QUEUE_MAX_OPS * 2];
+	uint16_t flags[ICE_QUEUE_MAX_OPS * 2];
+
+	if (num > ARRAY_SIZE(orig))
+		return i2c_transfer(core_i2c->client->adapter, msgs, num);
+
+	for (i = 0; i < num; i++) {
+		orig[i] = msgs[i].buf;
+		flags[i] = msgs[i].flags;
+
+		if (msgs[i].len < core_i2c->dma_threshold || (msgs[i].flags & I2C_M_DMA_SAFE))
+			continue;
+
+		if (i2c_dma_is_safe(msgs[i].buf, msgs[i].len)) {
+			msgs[i].flags |= I2C_M_DMA_SAFE;
+			continue;
+		}
+
+		bounce = i2c_dma_get_slot(msgs[i].len);
+		if (bounce != NULL) {
+			if (!(msgs[i].flags & I2C_M_RD))
+				memcpy(bounce, msgs[i].buf, msgs[i].len);
+		} else {
+			bounce = i2c_get_dma_safe_msg_buf(&msgs[i], core_i2c->dma_threshold);
+			if (bounce == NULL)
+				continue;
+		}
+
+		msgs[i].buf = bounce;
+		msgs[i].flags |= I2C_M_DMA_SAFE;
+	}
+
+	res = i2c_transfer(core_i2c->client->adapter, msgs, num);
+
+	for (i = 0; i < num; i++) {
+		bounce = msgs[i].buf;
+		msgs[i].buf = orig[i];
+		msgs[i].flags = flags[i];
+
+		if (bounce == orig[i])
+			continue;
+
+		if (i2c_dma_is_slot(bounce)) {
+			if (res == num && (msgs[i].flags & I2C_M_RD))
+				memcpy(msgs[i].buf, bounce, msgs[i].len);
+			i2c_dma_put_slot(bounce);
+		} else {
+			i2c_put_dma_safe_msg_buf(bounce, &msgs[i], res == num);
+		}
+	}
+
+	return res;
+}
+#else
+#define i2c_dma_transfer(msgs, num)	i2c_transfer(core_i2c->client->adapter, msgs, num)
+#endif /* I2C_DMA_SAFE */
+
+/*
+ * Allocate a buffer which messages can be sent from without a bounce. It's
+ * plain kzalloc, aligned to ARCH_DMA_MINALIGN, as devres only aligns its data
+ * to 8 bytes before v4.20. Pair it with core_i2c_dma_free(). The buffer is
+ * recorded for i2c_dma_transfer() to know it needn't be bounced.
+ */
+void *core_i2c_dma_alloc(size_t size)
+{
+	uint8_t *buf = kzalloc(size, GFP_KERNEL);
+#ifdef I2C_DMA_SAFE
+	int i;
+
+	if (ERR_ALLOC_MEM(buf))
+		return buf;
+
+	spin_lock(&i2c_dma_lock);
+	for (i = 0; i < I2C_DMA_REGION_NUM; i++) {
+		if (i2c_dma_region[i].buf == NULL) {
+			i2c_dma_region[i].buf = buf;
+			i2c_dma_region[i].size = size;
+			break;
+		}
+	}
+	spin_unlock(&i2c_dma_lock);
+
+	if (i == I2C_DMA_REGION_NUM)
+		ipio_debug(DEBUG_I2C, "No region left for buf (%zu), it'll be bounced\n", size);
+#endif /* I2C_DMA_SAFE */
+
+	return buf;
+}
+EXPORT_SYMBOL(core_i2c_dma_alloc);
+
+void core_i2c_dma_free(void *buf)
+{
+#ifdef I2C_DMA_SAFE
+	int i;
+
+	if (buf == NULL)
+		return;
+
+	spin_lock(&i2c_dma_lock);
+	for (i = 0; i < I2C_DMA_REGION_NUM; i++) {
+		if (i2c_dma_region[i].buf == buf) {
+			i2c_dma_region[i].buf = NULL;
+			i2c_dma_region[i].size = 0;
+			break;
+		}
+	}
+	spin_unlock(&i2c_dma_lock);
+#endif /* I2C_DMA_SAFE */
+
+	kfree(buf);
+}
+EXPORT_SYMBOL(core_i2c_dma_free);
+
 int core_i2c_write(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
 {
 	int res = 0;
 	uint8_t check_sum = 0;
-	uint8_t *txbuf = NULL;
+	bool scratch = false;
 
 	struct i2c_msg msgs[] = {
 		{
@@ -89,21 +278,24 @@ int core_i2c_write(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
 	 */
 	if (protocol->major >= 5 && protocol->mid >= 4) {
 		if (pBuf[0] == 0xF1 && core_fr->actual_fw_mode == protocol->test_mode) {
-			check_sum = core_fr_calc_checksum(pBuf, nSize);
-			txbuf = (uint8_t*)kcalloc(nSize + 1, sizeof(uint8_t), GFP_KERNEL);
-			if (ERR_ALLOC_MEM(txbuf)) {
-				ipio_err("Failed to allocate txbuf mem\n");
-				res = -ENOMEM;
+			if (nSize + 1 > core_i2c->txbuf_size) {
+				ipio_err("The length (%d) is over txbuf (%d)\n", nSize + 1, core_i2c->txbuf_size);
+				res = -EINVAL;
 				goto out;
 			}
-			memcpy(txbuf, pBuf, nSize);
-			txbuf[nSize] = check_sum;
-			msgs[0].buf = txbuf;
+
+			check_sum = core_fr_calc_checksum(pBuf, nSize);
+
+			mutex_lock(&core_i2c->lock);
+			scratch = true;
+			memcpy(core_i2c->txbuf, pBuf, nSize);
+			core_i2c->txbuf[nSize] = check_sum;
+			msgs[0].buf = core_i2c->txbuf;
 			msgs[0].len = nSize + 1;
 		}
 	}
 
-	if (i2c_transfer(core_i2c->client->adapter, msgs, 1) < 0) {
+	if (i2c_dma_transfer(msgs, 1) < 0) {
 		if (core_config->do_ic_reset) {
 			/* ignore i2c error if doing ic reset */
 			res = 0;
@@ -115,7 +307,8 @@ int core_i2c_write(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
 	}
 
 out:
-	ipio_kfree((void **)&txbuf);
+	if (scratch)
+		mutex_unlock(&core_i2c->lock);
 	return res;
 }
 EXPORT_SYMBOL(core_i2c_write);
@@ -144,7 +337,7 @@ int core_i2c_read(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
 	}
 #endif /* I2C_DMA */
 
-	if (i2c_transfer(core_i2c->client->adapter, msgs, 1) < 0) {
+	if (i2c_dma_transfer(msgs, 1) < 0) {
 		res = -EIO;
 		ipio_err("I2C Read Error, res = %d\n", res);
 		goto out;
@@ -160,6 +353,165 @@ out:
 }
 EXPORT_SYMBOL(core_i2c_read);
 
+/*
+ * Write the command and read its response back in a single transfer, so the
+ * bus is held with a repeated start and no other master can come in between.
+ * It doesn't append the checksum of MP test as core_i2c_write() does.
+ */
+int core_i2c_write_read(uint8_t nSlaveId, uint8_t *wbuf, uint16_t wsize, uint8_t *rbuf, uint16_t rsize)
+{
+	int res = 0;
+
+	struct i2c_msg msgs[] = {
+		{
+		 .addr = nSlaveId,
+		 .flags = 0,	/* write flag. */
+		 .len = wsize,
+		 .buf = wbuf,
+		 },
+		{
+		 .addr = nSlaveId,
+		 .flags = I2C_M_RD,	/* read flag */
+		 .len = rsize,
+		 .buf = rbuf,
+		 },
+	};
+
+#ifdef I2C_DMA
+	/* The DMA buffer can't be shared by both messages, go through them one by one */
+	if (wsize > 8 || rsize > 8) {
+		res = core_i2c_write(nSlaveId, wbuf, wsize);
+		if (res < 0)
+			goto out;
+
+		res = core_i2c_read(nSlaveId, rbuf, rsize);
+		goto out;
+	}
+#endif /* I2C_DMA */
+
+	if (i2c_dma_transfer(msgs, ARRAY_SIZE(msgs)) < 0) {
+		res = -EIO;
+		ipio_err("I2C Write/Read Error, res = %d\n", res);
+		goto out;
+	}
+
+out:
+	return res;
+}
+EXPORT_SYMBOL(core_i2c_write_read);
+
+/*
+ * Send messages built by callers in a single transfer. It returns the errno
+ * from adapter, e.g. -EOPNOTSUPP if its quirks refuse the messages.
+ */
+int core_i2c_transfer(struct i2c_msg *msgs, int num)
+{
+	int res = i2c_dma_transfer(msgs, num);
+
+	if (res < 0) {
+		ipio_err("I2C Transfer Error, num = %d, res = %d\n", num, res);
+		return res;
+	}
+
+	if (res != num) {
+		ipio_err("I2C Transfer only sent %d of %d msgs\n", res, num);
+		return -EIO;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL(core_i2c_transfer);
+
+/* Send ops of the queue one by one, a read goes with its own write-read */
+static int i2c_ice_transfer_each(struct core_ice_queue *q)
+{
+	int i, res = 0;
+	struct core_ice_op *op = NULL;
+
+	for (i = 0; i < q->num; i++) {
+		op = &q->op[i];
+		if (op->rlen)
+			res = core_i2c_write_read(core_config->slave_i2c_addr, op->buf, op->len, op->rbuf, op->rlen);
+		else
+			res = core_i2c_write(core_config->slave_i2c_addr, op->buf, op->len);
+
+		if (res < 0)
+			break;
+	}
+
+	return res;
+}
+
+#ifdef I2C_DMA
+/* Messages over 8 bytes share the only DMA buffer, so they can't be batched */
+int core_i2c_ice_transfer(struct core_ice_queue *q)
+{
+	return i2c_ice_transfer_each(q);
+}
+#else
+/* Whether the quirks of adapter allow the number of messages at once */
+static bool i2c_can_batch(int num)
+{
+#if KERNEL_VERSION(4, 1, 0) <= LINUX_VERSION_CODE
+	const struct i2c_adapter_quirks *quirks = core_i2c->client->adapter->quirks;
+
+	if (quirks == NULL)
+		return true;
+
+	if (quirks->max_num_msgs && num > quirks->max_num_msgs)
+		return false;
+
+	/* only a write followed by a read can be combined */
+	if ((quirks->flags & I2C_AQ_COMB) && num > 2)
+		return false;
+#endif
+
+	return true;
+}
+
+int core_i2c_ice_transfer(struct core_ice_queue *q)
+{
+	int i, res, num = 0;
+	struct core_ice_op *op = NULL;
+	struct i2c_msg msgs[ICE_QUEUE_MAX_OPS * 2];
+
+	if (core_i2c->ice_each)
+		return i2c_ice_transfer_each(q);
+
+	for (i = 0; i < q->num; i++) {
+		op = &q->op[i];
+
+		msgs[num].addr = core_config->slave_i2c_addr;
+		msgs[num].flags = 0;
+		msgs[num].len = op->len;
+		msgs[num].buf = op->buf;
+		num++;
+
+		if (op->rlen) {
+			msgs[num].addr = core_config->slave_i2c_addr;
+			msgs[num].flags = I2C_M_RD;
+			msgs[num].len = op->rlen;
+			msgs[num].buf = op->rbuf;
+			num++;
+		}
+	}
+
+	if (!i2c_can_batch(num))
+		return i2c_ice_transfer_each(q);
+
+	res = core_i2c_transfer(msgs, num);
+	if (res == -EOPNOTSUPP) {
+		/* nothing was sent, so the ops can go again and never batch from now on */
+		ipio_info("Adapter can't take %d msgs at once, send ops one by one\n", num);
+		core_i2c->ice_each = true;
+		res = i2c_ice_transfer_each(q);
+	}
+
+	return res;
+}
+#endif /* I2C_DMA */
+EXPORT_SYMBOL(core_i2c_ice_transfer);
+
 int core_i2c_segmental_read(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
 {
 	int res = 0;
@@ -188,7 +540,7 @@ int core_i2c_segmental_read(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
 
 		ipio_debug(DEBUG_I2C, "Length = %d\n", msgs[0].len);
 
-		if (i2c_transfer(core_i2c->client->adapter, msgs, 1) < 0) {
+		if (i2c_dma_transfer(msgs, 1) < 0) {
 			res = -EIO;
 			ipio_err("I2C Read Error, res = %d\n", res);
 			goto out;
@@ -200,6 +552,15 @@ out:
 }
 EXPORT_SYMBOL(core_i2c_segmental_read);
 
+struct core_bus_ops core_i2c_bus_ops = {
+	.name = "i2c",
+	.write = core_i2c_write,
+	.read = core_i2c_read,
+	.write_read = core_i2c_write_read,
+	.ice_transfer = core_i2c_ice_transfer,
+};
+EXPORT_SYMBOL(core_i2c_bus_ops);
+
 int core_i2c_init(struct i2c_client *client)
 {
 	int i;
@@ -212,6 +573,29 @@ int core_i2c_init(struct i2c_client *client)
 
 	core_i2c->client = client;
 	core_i2c->seg_len = 256;	/* length of segment */
+	core_i2c->ice_each = false;
+
+	/* scratch buffers are kmalloc'ed to be dma-safe, see core_i2c_dma_alloc() */
+	mutex_init(&core_i2c->lock);
+	core_i2c->txbuf_size = I2C_TXBUF_SIZE;
+	core_i2c->txbuf = core_i2c_dma_alloc(core_i2c->txbuf_size);
+	if (ERR_ALLOC_MEM(core_i2c->txbuf)) {
+		ipio_err("Failed to allocate i2c txbuf, %ld\n", PTR_ERR(core_i2c->txbuf));
+		return -ENOMEM;
+	}
+
+#ifdef I2C_DMA_SAFE
+	core_i2c->dma_threshold = I2C_DMA_THRESHOLD;
+	core_i2c->dma_slot_map = 0;
+	core_i2c->dma_slot_size = ALIGN(P5_0_DEBUG_MODE_PACKET_LENGTH, dma_get_cache_alignment());
+	core_i2c->dma_pool = kzalloc(I2C_DMA_POOL_NUM * core_i2c->dma_slot_size, GFP_KERNEL);
+	if (ERR_ALLOC_MEM(core_i2c->dma_pool)) {
+		ipio_err("Failed to allocate i2c dma pool, %ld\n", PTR_ERR(core_i2c->dma_pool));
+		core_i2c_dma_free(core_i2c->txbuf);
+		core_i2c->txbuf = NULL;
+		return -ENOMEM;
+	}
+#endif /* I2C_DMA_SAFE */
 
 #ifdef I2C_DMA
 	if (dma_alloc(core_i2c->client) < 0) {
@@ -233,3 +617,18 @@ int core_i2c_init(struct i2c_client *client)
 	return 0;
 }
 EXPORT_SYMBOL(core_i2c_init);
+
+void core_i2c_remove(void)
+{
+	ipio_info("Remove core-i2c members\n");
+
+	if (core_i2c == NULL)
+		return;
+
+	core_i2c_dma_free(core_i2c->txbuf);
+	core_i2c->txbuf = NULL;
+#ifdef I2C_DMA_SAFE
+	ipio_kfree((void **)&core_i2c->dma_pool);
+#endif /* I2C_DMA_SAFE */
+}
+EXPORT_SYMBOL(core_i2c_remove);
@@ -25,19 +25,46 @@
 #ifndef __I2C_H
 #define __I2C_H
 
+struct core_ice_queue;
+
 struct core_i2c_data {
 	struct i2c_client *client;
 	int clk;
 	int seg_len;
+
+	/* adapter refused a whole ice queue in one transfer, send ops one by one */
+	bool ice_each;
+
+	/* scratch for data built by driver before sending, held by lock */
+	struct mutex lock;
+	uint8_t *txbuf;
+	uint16_t txbuf_size;
+
+#ifdef I2C_DMA_SAFE
+	/* messages at least this long are handed to adapter as dma-safe */
+	uint16_t dma_threshold;
+	uint8_t *dma_pool;
+	/* aligned to dma_get_cache_alignment(), so slots never share a line */
+	uint32_t dma_slot_size;
+	unsigned long dma_slot_map;
+#endif
 };
 
 extern struct core_i2c_data *core_i2c;
+extern struct core_bus_ops core_i2c_bus_ops;
 
 extern int core_i2c_write(uint8_t, uint8_t *, uint16_t);
 extern int core_i2c_read(uint8_t, uint8_t *, uint16_t);
+extern int core_i2c_write_read(uint8_t, uint8_t *, uint16_t, uint8_t *, uint16_t);
 
+extern int core_i2c_transfer(struct i2c_msg *, int);
+extern int core_i2c_ice_transfer(struct core_ice_queue *q);
 extern int core_i2c_segmental_read(uint8_t, uint8_t *, uint16_t);
 
+extern void *core_i2c_dma_alloc(size_t);
+extern void core_i2c_dma_free(void *);
+
 extern int core_i2c_init(struct i2c_client *);
+extern void core_i2c_remove(void);
 
 #endif
@@ -0,0 +1,240 @@
+/*
+ * ILITEK Touch IC driver
+ *
+ * Copyright (C) 2011 ILI Technology Corporation.
+ *
+ * Author: Dicky Chiang <dicky_chiang@ilitek.com>
+ * Based on TDD v7.0 implemented by Mstar & ILITEK
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/atomic.h>
+
+#include "../common.h"
+#include "../platform.h"
+#include "latency.h"
+
+#ifdef LATENCY_STAT
+
+struct latency_hist {
+	uint32_t bucket[LATENCY_BUCKET_NUM];
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+};
+
+/*
+ * Timestamps and histograms are only written by the path handling an
+ * interrupt event, which never runs concurrently with itself because the
+ * irq is masked until it finishes. Readers take no lock and might see a
+ * sample being added, and reset is deferred to the writer for that reason.
+ */
+struct core_latency_data {
+	ktime_t stamp[LATENCY_STAGE_NUM];
+	uint32_t marked;
+	struct latency_hist hist[LATENCY_STAGE_NUM];
+	atomic_t reset;
+	struct dentry *dir;
+};
+
+static struct core_latency_data *core_latency = NULL;
+
+static const char *latency_stage_name[LATENCY_STAGE_NUM] = {
+	"irq", "handler", "read", "parse", "input_sync",
+};
+
+void core_latency_mark(int stage)
+{
+	if (core_latency == NULL)
+		return;
+
+	/* A new event starts from the hard irq, drop what the last one left */
+	if (stage == LATENCY_IRQ)
+		core_latency->marked = 0;
+
+	core_latency->stamp[stage] = ktime_get();
+	core_latency->marked |= BIT(stage);
+}
+EXPORT_SYMBOL(core_latency_mark);
+
+static void latency_hist_add(struct latency_hist *h, uint32_t us)
+{
+	int n = fls(us);
+
+	if (n >= LATENCY_BUCKET_NUM)
+		n = LATENCY_BUCKET_NUM - 1;
+
+	h->bucket[n]++;
+	h->sum += us;
+
+	if (h->count == 0 || us < h->min)
+		h->min = us;
+	if (us > h->max)
+		h->max = us;
+
+	h->count++;
+}
+
+void core_latency_commit(void)
+{
+	int i;
+	s64 us;
+
+	if (core_latency == NULL)
+		return;
+
+	if (atomic_xchg(&core_latency->reset, 0))
+		memset(core_latency->hist, 0, sizeof(core_latency->hist));
+
+	if (!(core_latency->marked & BIT(LATENCY_IRQ)))
+		goto out;
+
+	for (i = LATENCY_HANDLER; i < LATENCY_STAGE_NUM; i++) {
+		if (!(core_latency->marked & BIT(i)))
+			continue;
+
+		us = ktime_us_delta(core_latency->stamp[i], core_latency->stamp[LATENCY_IRQ]);
+		if (us < 0)
+			continue;
+
+		latency_hist_add(&core_latency->hist[i], (uint32_t)us);
+	}
+
+out:
+	core_latency->marked = 0;
+}
+EXPORT_SYMBOL(core_latency_commit);
+
+/* Return the upper bound of the bucket where the percentile falls into */
+static uint32_t latency_hist_percentile(struct latency_hist *h, int percent)
+{
+	int i;
+	uint32_t sum = 0, target;
+
+	if (h->count == 0)
+		return 0;
+
+	target = (uint32_t)div_u64((uint64_t)h->count * percent + 99, 100);
+
+	for (i = 0; i < LATENCY_BUCKET_NUM; i++) {
+		sum += h->bucket[i];
+		if (sum >= target)
+			break;
+	}
+
+	if (i >= LATENCY_BUCKET_NUM - 1)
+		return h->max;
+
+	return min_t(uint32_t, (1U << i) - 1, h->max);
+}
+
+static int latency_show(struct seq_file *m, void *v)
+{
+	int i, j;
+	struct latency_hist h;
+
+	seq_puts(m, "stage        count      min      avg      p50      p90      p99      max (us)\n");
+
+	for (i = LATENCY_HANDLER; i < LATENCY_STAGE_NUM; i++) {
+		memcpy(&h, &core_latency->hist[i], sizeof(h));
+
+		seq_printf(m, "%-10s %7u %8u %8llu %8u %8u %8u %8u\n", latency_stage_name[i],
+			h.count, h.min, h.count ? (unsigned long long)div_u64(h.sum, h.count) : 0ULL,
+			latency_hist_percentile(&h, 50), latency_hist_percentile(&h, 90),
+			latency_hist_percentile(&h, 99), h.max);
+	}
+
+	seq_puts(m, "\nlog2 histogram from irq, bucket n = [2^(n-1), 2^n) us\n");
+
+	for (i = LATENCY_HANDLER; i < LATENCY_STAGE_NUM; i++) {
+		seq_printf(m, "%-10s", latency_stage_name[i]);
+		for (j = 0; j < LATENCY_BUCKET_NUM; j++)
+			seq_printf(m, " %u", core_latency->hist[i].bucket[j]);
+		seq_puts(m, "\n");
+	}
+
+	return 0;
+}
+
+static int latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, latency_show, NULL);
+}
+
+static const struct file_operations latency_fops = {
+	.owner = THIS_MODULE,
+	.open = latency_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static ssize_t latency_reset_write(struct file *filp, const char __user *buff, size_t size, loff_t *pPos)
+{
+	/* Applied by the irq path at the next event */
+	atomic_set(&core_latency->reset, 1);
+	ipio_info("Reset latency statistics\n");
+	return size;
+}
+
+static const struct file_operations latency_reset_fops = {
+	.owner = THIS_MODULE,
+	.write = latency_reset_write,
+};
+
+int core_latency_init(void)
+{
+	core_latency = devm_kzalloc(ipd->dev, sizeof(*core_latency), GFP_KERNEL);
+	if (ERR_ALLOC_MEM(core_latency)) {
+		ipio_err("Failed to allocate core_latency mem, %ld\n", PTR_ERR(core_latency));
+		core_latency = NULL;
+		return -ENOMEM;
+	}
+
+	atomic_set(&core_latency->reset, 0);
+
+	core_latency->dir = debugfs_create_dir("ilitek", NULL);
+	if (ERR_ALLOC_MEM(core_latency->dir)) {
+		ipio_err("Failed to create debugfs dir, latency is only collected\n");
+		core_latency->dir = NULL;
+		return 0;
+	}
+
+	debugfs_create_file("latency", S_IRUGO, core_latency->dir, NULL, &latency_fops);
+	debugfs_create_file("latency_reset", S_IWUSR, core_latency->dir, NULL, &latency_reset_fops);
+
+	return 0;
+}
+EXPORT_SYMBOL(core_latency_init);
+
+void core_latency_remove(void)
+{
+	ipio_info("Remove core-latency members\n");
+
+	if (core_latency == NULL)
+		return;
+
+	debugfs_remove_recursive(core_latency->dir);
+	core_latency = NULL;
+}
+EXPORT_SYMBOL(core_latency_remove);
+
+#endif /* LATENCY_STAT */
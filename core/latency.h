@@ -0,0 +1,53 @@
+/*
+ * ILITEK Touch IC driver
+ *
+ * Copyright (C) 2011 ILI Technology Corporation.
+ *
+ * Author: Dicky Chiang <dicky_chiang@ilitek.com>
+ * Based on TDD v7.0 implemented by Mstar & ILITEK
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+/* The stages of handling an interrupt event, timed from the hard irq */
+enum {
+	LATENCY_IRQ = 0,
+	LATENCY_HANDLER,
+	LATENCY_READ,
+	LATENCY_PARSE,
+	LATENCY_SYNC,
+	LATENCY_STAGE_NUM,
+};
+
+/* Bucket n counts the samples in [2^(n-1), 2^n) us, the last one is everything above */
+#define LATENCY_BUCKET_NUM	20
+
+#ifdef LATENCY_STAT
+extern void core_latency_mark(int stage);
+extern void core_latency_commit(void);
+extern int core_latency_init(void);
+extern void core_latency_remove(void);
+#else
+static inline void core_latency_mark(int stage) {}
+static inline void core_latency_commit(void) {}
+static inline int core_latency_init(void) { return 0; }
+static inline void core_latency_remove(void) {}
+#endif /* LATENCY_STAT */
+
+#endif
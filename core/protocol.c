@@ -27,6 +27,8 @@
 #include "i2c.h"
 #include "spi.h"
 #include "protocol.h"
+#include "finger_report.h"
+#include "emu.h"
 
 #define FUNC_NUM    20
 
@@ -46,18 +48,119 @@ struct DataItem {
 struct DataItem *hashArray[FUNC_NUM];
 struct protocol_cmd_list *protocol = NULL;
 
+struct core_bus_ops *core_bus = &core_i2c_bus_ops;
+
+static struct core_bus_ops *bus_list[] = {
+	&core_i2c_bus_ops,
+	&core_spi_bus_ops,
+#ifdef BUS_EMULATOR
+	&core_emu_bus_ops,
+#endif
+};
+
+/*
+ * How long (us) firmware needs before the response of a command can be read,
+ * indexed by the first byte written. Zero means it's read with a repeated start.
+ */
+static uint16_t g_turnaround_us[256];
+
 int core_write(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
 {
-	return core_i2c_write(nSlaveId, pBuf, nSize);
+	return core_bus->write(nSlaveId, pBuf, nSize);
 }
 EXPORT_SYMBOL(core_write);
 
 int core_read(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
 {
-	return core_i2c_read(nSlaveId, pBuf, nSize);
+	return core_bus->read(nSlaveId, pBuf, nSize);
 }
 EXPORT_SYMBOL(core_read);
 
+/*
+ * Write a command and read its response. If the command has no turnaround
+ * delay, both are done in a single transfer; otherwise it sleeps for the delay
+ * in between rather than busy waiting, which is still a write and a read.
+ *
+ * Only ICE reads and the CDC busy poll have no delay now. Firmware info
+ * commands need 1ms before their response is ready, and a repeated start
+ * can't hold the bus for that long.
+ */
+int core_write_read(uint8_t nSlaveId, uint8_t *wbuf, uint16_t wsize, uint8_t *rbuf, uint16_t rsize)
+{
+	int res = 0;
+	unsigned int delay = g_turnaround_us[wbuf[0]];
+
+	if (delay == 0)
+		return core_bus->write_read(nSlaveId, wbuf, wsize, rbuf, rsize);
+
+	res = core_write(nSlaveId, wbuf, wsize);
+	if (res < 0)
+		return res;
+
+	usleep_range(delay, delay + delay / 4);
+
+	return core_read(nSlaveId, rbuf, rsize);
+}
+EXPORT_SYMBOL(core_write_read);
+
+/* Wait until firmware is able to take the next command after cmd */
+void core_protocol_turnaround(uint8_t cmd)
+{
+	unsigned int delay = g_turnaround_us[cmd];
+
+	if (delay)
+		usleep_range(delay, delay + delay / 4);
+}
+EXPORT_SYMBOL(core_protocol_turnaround);
+
+/*
+ * Switch R/W with IC to the backend with the name. It must be done before
+ * talking to IC, as nothing is held across the switch.
+ */
+int core_protocol_set_bus(const char *name)
+{
+	int i;
+	struct core_bus_ops *ops = NULL;
+
+	for (i = 0; i < ARRAY_SIZE(bus_list); i++) {
+		if (strcmp(bus_list[i]->name, name) == 0) {
+			ops = bus_list[i];
+			break;
+		}
+	}
+
+	if (ops == NULL) {
+		ipio_err("Unknown bus (%s)\n", name);
+		return -EINVAL;
+	}
+
+	if (ops->init != NULL && ops->init() < 0) {
+		ipio_err("Failed to init bus (%s)\n", name);
+		return -ENODEV;
+	}
+
+	core_bus = ops;
+	ipio_info("R/W with IC via %s\n", core_bus->name);
+	return 0;
+}
+EXPORT_SYMBOL(core_protocol_set_bus);
+
+static void update_turnaround(void)
+{
+	memset(g_turnaround_us, 0x0, sizeof(g_turnaround_us));
+
+	/* Commands handled by firmware, the ICE mode (0x25) is done by hardware */
+	g_turnaround_us[protocol->cmd_read_ctrl] = PROTOCOL_FW_TURNAROUND_US;
+	g_turnaround_us[protocol->cmd_get_tp_info] = PROTOCOL_FW_TURNAROUND_US;
+	g_turnaround_us[protocol->cmd_get_key_info] = PROTOCOL_FW_TURNAROUND_US;
+	g_turnaround_us[protocol->cmd_get_fw_ver] = PROTOCOL_FW_TURNAROUND_US;
+	g_turnaround_us[protocol->cmd_get_pro_ver] = PROTOCOL_FW_TURNAROUND_US;
+	g_turnaround_us[protocol->cmd_get_core_ver] = PROTOCOL_FW_TURNAROUND_US;
+
+	/* The busy state is polled without any delay */
+	g_turnaround_us[protocol->cmd_cdc_busy] = 0;
+}
+
 static int hashCode(int key)
 {
 	return key % FUNC_NUM;
@@ -372,6 +475,10 @@ int core_protocol_update_ver(uint8_t major, uint8_t mid, uint8_t minor)
 
 			/* We need to recreate function controls because of the commands updated. */
 			create_func_hash();
+			update_turnaround();
+
+			/* The callback of finger report only changes with protocol */
+			core_fr_update_report();
 			return 0;
 		}
 	}
@@ -30,6 +30,9 @@
 #define P3_2_GET_FIRMWARE_VERSION	0x40
 #define P3_2_GET_PROTOCOL_VERSION	0x42
 
+/* The time firmware needs to prepare the response of a command */
+#define PROTOCOL_FW_TURNAROUND_US	1000
+
 /* V5.X */
 #define P5_0_READ_DATA_CTRL			    0xF6
 #define P5_0_GET_TP_INFORMATION		    0x20
@@ -179,10 +182,32 @@ struct protocol_cmd_list {
 
 extern struct protocol_cmd_list *protocol;
 
+struct core_ice_queue;
+
+/*
+ * A backend that carries R/W with IC. The one used is selected by the
+ * property of dts at probe, and it's i2c if nothing is given.
+ */
+struct core_bus_ops {
+	const char *name;
+	int (*init)(void);
+	int (*write)(uint8_t, uint8_t *, uint16_t);
+	int (*read)(uint8_t, uint8_t *, uint16_t);
+	int (*write_read)(uint8_t, uint8_t *, uint16_t, uint8_t *, uint16_t);
+	int (*ice_transfer)(struct core_ice_queue *q);
+	/* frames are raised by software instead of the irq of IC */
+	bool no_irq;
+};
+
+extern struct core_bus_ops *core_bus;
+
 extern void core_protocol_func_control(int key, int ctrl);
 extern int core_protocol_update_ver(uint8_t major, uint8_t mid, uint8_t minor);
 extern int core_protocol_init(void);
 extern int core_write(uint8_t, uint8_t *, uint16_t);
 extern int core_read(uint8_t, uint8_t *, uint16_t);
+extern int core_write_read(uint8_t, uint8_t *, uint16_t, uint8_t *, uint16_t);
+extern void core_protocol_turnaround(uint8_t cmd);
+extern int core_protocol_set_bus(const char *name);
 
 #endif
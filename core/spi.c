@@ -27,9 +27,39 @@
 #include "config.h"
 #include "spi.h"
 #include "finger_report.h"
+#include "protocol.h"
 
 struct core_spi_data *core_spi;
 
+/* A block of iram upgrade or a packet at debug mode, plus the header and lock */
+#define SPI_BUF_SIZE	(max_t(int, SPI_UPGRADE_LEN, P5_0_DEBUG_MODE_PACKET_LENGTH) + 16)
+
+/*
+ * Send wlen bytes in txbuf and then read rlen bytes into rxbuf with chip
+ * select held, as spi_write_then_read() does but without its bounce buffer.
+ * The caller must hold core_spi->lock.
+ */
+static int spi_scratch_write_then_read(uint32_t wlen, uint32_t rlen)
+{
+	struct spi_message msg;
+	struct spi_transfer xfer[2];
+
+	if (wlen > core_spi->buf_size || rlen > core_spi->buf_size) {
+		ipio_err("The length (%d/%d) is over spi buffer (%d)\n", wlen, rlen, core_spi->buf_size);
+		return -EINVAL;
+	}
+
+	memset(xfer, 0, sizeof(xfer));
+	xfer[0].tx_buf = core_spi->txbuf;
+	xfer[0].len = wlen;
+	xfer[1].rx_buf = core_spi->rxbuf;
+	xfer[1].len = rlen;
+
+	spi_message_init_with_transfers(&msg, xfer, rlen ? 2 : 1);
+
+	return spi_sync(core_spi->spi, &msg);
+}
+
 int core_Rx_check(uint16_t check)
 {
 	int size = 0, i, count = 100;
@@ -124,11 +154,12 @@ int core_ice_mode_read_9881H11(uint8_t *data, uint32_t size)
 	}
 
 	/* read data */
-	txbuf[0] = SPI_READ;
-	if (spi_write_then_read(core_spi->spi, txbuf, 1, data, size) < 0) {
+	core_spi->txbuf[0] = SPI_READ;
+	if (spi_scratch_write_then_read(1, size) < 0) {
 		res = -EIO;
 		return res;
 	}
+	memcpy(data, core_spi->rxbuf, size);
 
 	/* write data unlock */
 	txbuf[0] = SPI_WRITE;
@@ -151,14 +182,14 @@ int core_ice_mode_read_9881H11(uint8_t *data, uint32_t size)
 int core_ice_mode_write_9881H11(uint8_t *data, uint32_t size)
 {
 	int res = 0;
-	uint8_t check_sum = 0,wsize = 0;
-	uint8_t *txbuf = NULL;
-
-    txbuf = kcalloc(size + 9, sizeof(uint8_t), GFP_KERNEL);
-	if (ERR_ALLOC_MEM(txbuf)) {
-		ipio_err("Failed to allocate txbuf\n");
-		res = -ENOMEM;
-		goto out;
+	uint32_t wsize = 0;
+	uint8_t check_sum = 0;
+	uint8_t *txbuf = core_spi->txbuf;
+
+	/* data, checksum and padding to 4 bytes after the header */
+	if (size + 9 > core_spi->buf_size) {
+		ipio_err("The length (%d) is over spi buffer (%d)\n", size, core_spi->buf_size);
+		return -EINVAL;
 	}
 
 	/* Write data */
@@ -177,7 +208,7 @@ int core_ice_mode_write_9881H11(uint8_t *data, uint32_t size)
 	if(wsize % 4 != 0)
 		wsize += 4 - (wsize % 4);
 
-	if (spi_write_then_read(core_spi->spi, txbuf, wsize + 5, txbuf, 0) < 0) {
+	if (spi_write(core_spi->spi, txbuf, wsize + 5) < 0) {
 		res = -EIO;
 		ipio_err("spi Write Error, res = %d\n", res);
 		goto out;
@@ -193,13 +224,12 @@ int core_ice_mode_write_9881H11(uint8_t *data, uint32_t size)
 	txbuf[6] = size & 0xFF;
 	txbuf[7] = (char)0x5A;
 	txbuf[8] = (char)0xA5;
-	if (spi_write_then_read(core_spi->spi, txbuf, 9, txbuf, 0) < 0) {
+	if (spi_write(core_spi->spi, txbuf, 9) < 0) {
 		res = -EIO;
 		ipio_err("spi Write data lock Error, res = %d\n", res);
 	}
 
 out:
-	ipio_kfree((void **)&txbuf);
 	return res;
 }
 
@@ -285,13 +315,6 @@ out:
 int core_spi_write_9881H11(uint8_t *pBuf, uint16_t nSize)
 {
 	int res = 0;
-	uint8_t *txbuf = NULL;
-
-    txbuf = kcalloc(nSize + 5, sizeof(uint8_t), GFP_KERNEL);
-	if (ERR_ALLOC_MEM(txbuf)) {
-		ipio_err("Failed to allocate txbuf\n");
-		return -ENOMEM;
-	}
 
 	res = core_ice_mode_enable_9881H11();
 	if (res < 0)
@@ -306,33 +329,31 @@ int core_spi_write_9881H11(uint8_t *pBuf, uint16_t nSize)
 	}
 
 out:
-	ipio_kfree((void **)&txbuf);
 	return res;
 }
 
 int core_spi_write(uint8_t *pBuf, uint16_t nSize)
 {
 	int res = 0;
-	uint8_t *txbuf = NULL;
 
-    txbuf = kcalloc(nSize + 1, sizeof(uint8_t), GFP_KERNEL);
-	if (ERR_ALLOC_MEM(txbuf)) {
-		ipio_err("Failed to allocate txbuf\n");
-		return -ENOMEM;
-		goto out;
-	}
+	mutex_lock(&core_spi->lock);
 
 	if(core_config->icemodeenable == false) {
 		res = core_spi_write_9881H11(pBuf, nSize);
 		core_ice_mode_disable_9881H11();
-		ipio_kfree((void **)&txbuf);
-		return res;
+		goto out;
 	}
 
-	txbuf[0] = SPI_WRITE;
-    memcpy(txbuf+1, pBuf, nSize);
+	if (nSize + 1 > core_spi->buf_size) {
+		ipio_err("The length (%d) is over spi buffer (%d)\n", nSize, core_spi->buf_size);
+		res = -EINVAL;
+		goto out;
+	}
+
+	core_spi->txbuf[0] = SPI_WRITE;
+	memcpy(core_spi->txbuf + 1, pBuf, nSize);
 
-	if (spi_write_then_read(core_spi->spi, txbuf, nSize+1, txbuf, 0) < 0) {
+	if (spi_write(core_spi->spi, core_spi->txbuf, nSize + 1) < 0) {
 		if (core_config->do_ic_reset) {
 			/* ignore spi error if doing ic reset */
 			res = 0;
@@ -344,7 +365,7 @@ int core_spi_write(uint8_t *pBuf, uint16_t nSize)
 	}
 
 out:
-	ipio_kfree((void **)&txbuf);
+	mutex_unlock(&core_spi->lock);
 	return res;
 }
 EXPORT_SYMBOL(core_spi_write);
@@ -352,14 +373,17 @@ EXPORT_SYMBOL(core_spi_write);
 int core_spi_read(uint8_t *pBuf, uint16_t nSize)
 {
 	int res = 0;
-	uint8_t txbuf[1] = {0};
 
-	txbuf[0] = SPI_READ;
+	mutex_lock(&core_spi->lock);
+
+	if(core_config->icemodeenable == false) {
+		res = core_spi_read_9881H11(pBuf, nSize);
+		goto out;
+	}
 
-	if(core_config->icemodeenable == false)
-		return core_spi_read_9881H11(pBuf, nSize);
+	core_spi->txbuf[0] = SPI_READ;
 
-	if (spi_write_then_read(core_spi->spi, txbuf, 1, pBuf, nSize) < 0) {
+	if (spi_scratch_write_then_read(1, nSize) < 0) {
 		if (core_config->do_ic_reset) {
 			/* ignore spi error if doing ic reset */
 			res = 0;
@@ -370,11 +394,210 @@ int core_spi_read(uint8_t *pBuf, uint16_t nSize)
 		}
 	}
 
+	memcpy(pBuf, core_spi->rxbuf, nSize);
+
 out:
+	mutex_unlock(&core_spi->lock);
 	return res;
 }
 EXPORT_SYMBOL(core_spi_read);
 
+/*
+ * Write the command and read its response back with one spi message. It takes
+ * three transfers rather than two: IC wants the chip select released after
+ * the write (cs_change) as two separate calls do, and the read starts with
+ * its own SPI_READ byte before data is clocked in.
+ */
+int core_spi_write_read(uint8_t *wbuf, uint16_t wsize, uint8_t *rbuf, uint16_t rsize)
+{
+	int res = 0;
+	struct spi_message msg;
+	struct spi_transfer xfer[3];
+
+	if (core_config->icemodeenable == false) {
+		res = core_spi_write(wbuf, wsize);
+		if (res < 0)
+			return res;
+
+		return core_spi_read(rbuf, rsize);
+	}
+
+	if (wsize + 2 > core_spi->buf_size || rsize > core_spi->buf_size) {
+		ipio_err("The length (%d/%d) is over spi buffer (%d)\n", wsize, rsize, core_spi->buf_size);
+		return -EINVAL;
+	}
+
+	mutex_lock(&core_spi->lock);
+
+	core_spi->txbuf[0] = SPI_WRITE;
+	memcpy(core_spi->txbuf + 1, wbuf, wsize);
+	core_spi->txbuf[wsize + 1] = SPI_READ;
+
+	memset(xfer, 0, sizeof(xfer));
+	xfer[0].tx_buf = core_spi->txbuf;
+	xfer[0].len = wsize + 1;
+	xfer[0].cs_change = 1;
+	xfer[1].tx_buf = core_spi->txbuf + wsize + 1;
+	xfer[1].len = 1;
+	xfer[2].rx_buf = core_spi->rxbuf;
+	xfer[2].len = rsize;
+
+	spi_message_init_with_transfers(&msg, xfer, ARRAY_SIZE(xfer));
+
+	if (spi_sync(core_spi->spi, &msg) < 0) {
+		res = -EIO;
+		ipio_err("spi Write/Read Error, res = %d\n", res);
+		goto out;
+	}
+
+	memcpy(rbuf, core_spi->rxbuf, rsize);
+
+out:
+	mutex_unlock(&core_spi->lock);
+	return res;
+}
+EXPORT_SYMBOL(core_spi_write_read);
+
+/* Send ops of the queue one by one, a read goes with its own write-read */
+static int spi_ice_transfer_each(struct core_ice_queue *q)
+{
+	int i, res = 0;
+	struct core_ice_op *op = NULL;
+
+	for (i = 0; i < q->num; i++) {
+		op = &q->op[i];
+		if (op->rlen)
+			res = core_spi_write_read(op->buf, op->len, op->rbuf, op->rlen);
+		else
+			res = core_spi_write(op->buf, op->len);
+
+		if (res < 0)
+			break;
+	}
+
+	return res;
+}
+
+/*
+ * Queue all ops into one spi message, each one framed by its own chip select
+ * as core_spi_write() and core_spi_write_read() do. Outside ICE mode a write
+ * is the handshake of 9881H11, which depends on what IC answers between its
+ * steps, so ops are sent one by one there.
+ */
+int core_spi_ice_transfer(struct core_ice_queue *q)
+{
+	int i, n = 0, res = 0;
+	uint32_t tx = 0, rx = 0;
+	struct core_ice_op *op = NULL;
+	struct spi_message msg;
+	struct spi_transfer *xfer = core_spi->xfer;
+
+	if (core_config->icemodeenable == false)
+		return spi_ice_transfer_each(q);
+
+	mutex_lock(&core_spi->lock);
+
+	for (i = 0; i < q->num; i++) {
+		op = &q->op[i];
+
+		if (tx + op->len + 2 > core_spi->buf_size || rx + op->rlen > core_spi->buf_size) {
+			ipio_err("The queue is over spi buffer (%d) at op %d\n", core_spi->buf_size, i);
+			res = -EINVAL;
+			goto out;
+		}
+
+		core_spi->txbuf[tx] = SPI_WRITE;
+		memcpy(core_spi->txbuf + tx + 1, op->buf, op->len);
+		memset(&xfer[n], 0, sizeof(xfer[n]));
+		xfer[n].tx_buf = core_spi->txbuf + tx;
+		xfer[n].len = op->len + 1;
+		xfer[n].cs_change = 1;
+		tx += op->len + 1;
+		n++;
+
+		if (op->rlen == 0)
+			continue;
+
+		core_spi->txbuf[tx] = SPI_READ;
+		memset(&xfer[n], 0, sizeof(xfer[n]));
+		xfer[n].tx_buf = core_spi->txbuf + tx;
+		xfer[n].len = 1;
+		tx++;
+		n++;
+
+		memset(&xfer[n], 0, sizeof(xfer[n]));
+		xfer[n].rx_buf = core_spi->rxbuf + rx;
+		xfer[n].len = op->rlen;
+		xfer[n].cs_change = 1;
+		rx += op->rlen;
+		n++;
+	}
+
+	if (n == 0)
+		goto out;
+
+	/* cs_change on the last one would keep chip select after the message */
+	xfer[n - 1].cs_change = 0;
+
+	spi_message_init_with_transfers(&msg, xfer, n);
+
+	if (spi_sync(core_spi->spi, &msg) < 0) {
+		res = -EIO;
+		ipio_err("spi ICE transfer Error, res = %d\n", res);
+		goto out;
+	}
+
+	for (i = 0, rx = 0; i < q->num; i++) {
+		op = &q->op[i];
+		if (op->rlen == 0)
+			continue;
+
+		memcpy(op->rbuf, core_spi->rxbuf + rx, op->rlen);
+		rx += op->rlen;
+	}
+
+out:
+	mutex_unlock(&core_spi->lock);
+	return res;
+}
+EXPORT_SYMBOL(core_spi_ice_transfer);
+
+/* The slave id is meaningless on spi, they're only to fit struct core_bus_ops */
+static int spi_bus_init(void)
+{
+	if (core_spi == NULL) {
+		ipio_err("spi device isn't initialised\n");
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+static int spi_bus_write(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
+{
+	return core_spi_write(pBuf, nSize);
+}
+
+static int spi_bus_read(uint8_t nSlaveId, uint8_t *pBuf, uint16_t nSize)
+{
+	return core_spi_read(pBuf, nSize);
+}
+
+static int spi_bus_write_read(uint8_t nSlaveId, uint8_t *wbuf, uint16_t wsize, uint8_t *rbuf, uint16_t rsize)
+{
+	return core_spi_write_read(wbuf, wsize, rbuf, rsize);
+}
+
+struct core_bus_ops core_spi_bus_ops = {
+	.name = "spi",
+	.init = spi_bus_init,
+	.write = spi_bus_write,
+	.read = spi_bus_read,
+	.write_read = spi_bus_write_read,
+	.ice_transfer = core_spi_ice_transfer,
+};
+EXPORT_SYMBOL(core_spi_bus_ops);
+
 int core_spi_init(struct spi_device *spi)
 {
 	int ret;
@@ -386,12 +609,36 @@ int core_spi_init(struct spi_device *spi)
 	}
 
 	core_spi->spi = spi;
+	mutex_init(&core_spi->lock);
+
+	/*
+	 * Plain kmalloc is aligned to ARCH_DMA_MINALIGN, devres isn't before v4.20
+	 * since its header shares the cache line. Keep tx/rx apart as well.
+	 */
+	core_spi->buf_size = SPI_BUF_SIZE;
+	core_spi->txbuf = kzalloc(core_spi->buf_size, GFP_KERNEL);
+	core_spi->rxbuf = kzalloc(core_spi->buf_size, GFP_KERNEL);
+	if (ERR_ALLOC_MEM(core_spi->txbuf) || ERR_ALLOC_MEM(core_spi->rxbuf)) {
+		ipio_err("Failed to allocate spi buffers\n");
+		core_spi_remove();
+		return -ENOMEM;
+	}
+
+	/* a write, or a write, SPI_READ and the read for each op of ICE queue */
+	core_spi->xfer = devm_kcalloc(ipd->dev, ICE_QUEUE_MAX_OPS * 3, sizeof(*core_spi->xfer), GFP_KERNEL);
+	if (ERR_ALLOC_MEM(core_spi->xfer)) {
+		ipio_err("Failed to allocate spi transfers\n");
+		core_spi_remove();
+		return -ENOMEM;
+	}
+
 	spi->mode = SPI_MODE_0;
 	spi->bits_per_word = 8;
 
 	ret = spi_setup(spi);
 	if (ret < 0){
 		ipio_err("ERR: fail to setup spi\n");
+		core_spi_remove();
 		return -ENODEV;
 	}
 
@@ -401,3 +648,15 @@ int core_spi_init(struct spi_device *spi)
 	return 0;
 }
 EXPORT_SYMBOL(core_spi_init);
+
+void core_spi_remove(void)
+{
+	ipio_info("Remove core-spi members\n");
+
+	if (core_spi == NULL)
+		return;
+
+	ipio_kfree((void **)&core_spi->txbuf);
+	ipio_kfree((void **)&core_spi->rxbuf);
+}
+EXPORT_SYMBOL(core_spi_remove);
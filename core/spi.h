@@ -28,14 +28,28 @@
 #define SPI_WRITE 		0X82
 #define SPI_READ 		0X83
 
+struct core_ice_queue;
+
 struct core_spi_data {
 	struct spi_device *spi;
+
+	/* dma-safe bounce buffers, held by lock for a whole transaction */
+	struct mutex lock;
+	uint8_t *txbuf;
+	uint8_t *rxbuf;
+	uint32_t buf_size;
+
+	/* transfers of an ICE queue sent in one message, held by lock */
+	struct spi_transfer *xfer;
 };
 
 extern struct core_spi_data *core_spi;
+extern struct core_bus_ops core_spi_bus_ops;
 
 extern int core_spi_write(uint8_t *pBuf, uint16_t nSize);
 extern int core_spi_read(uint8_t *pBuf, uint16_t nSize);
+extern int core_spi_write_read(uint8_t *wbuf, uint16_t wsize, uint8_t *rbuf, uint16_t rsize);
+extern int core_spi_ice_transfer(struct core_ice_queue *q);
 extern int core_spi_init(struct spi_device *spi);
 extern void core_spi_remove(void);
 
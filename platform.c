@@ -32,10 +32,22 @@
 #include "platform.h"
 #include "core/mp_test.h"
 #include "core/gesture.h"
+#include "core/latency.h"
+#include "core/heatmap.h"
+#include "core/emu.h"
 #include <linux/wakelock.h>
 
 #define DTS_INT_GPIO	"touch,irq-gpio"
 #define DTS_RESET_GPIO	"touch,reset-gpio"
+#define DTS_SWAP_XY		"touch,swap-xy"
+#define DTS_INVERT_X	"touch,invert-x"
+#define DTS_INVERT_Y	"touch,invert-y"
+#define DTS_OFFSET_X	"touch,offset-x"
+#define DTS_OFFSET_Y	"touch,offset-y"
+#define DTS_SCREEN_X	"touch,screen-x"
+#define DTS_SCREEN_Y	"touch,screen-y"
+#define DTS_BUS			"touch,bus"
+#define DTS_DMA_THRESHOLD	"touch,dma-threshold"
 
 #define DTS_OF_NAME		"tchip,ilitek"
 
@@ -157,6 +169,22 @@ EXPORT_SYMBOL(ilitek_regulator_power_on);
 #endif /* REGULATOR_POWER_ON */
 
 #ifdef BATTERY_CHECK
+/*
+ * Periodic checks only need to run once the panel has been idle for a full
+ * interval. If a touch came in since, returns the delay left until the
+ * interval after that touch expires so the worker can requeue itself
+ * without doing the check, otherwise returns 0.
+ */
+static unsigned long ilitek_platform_touch_backoff(unsigned long interval)
+{
+	unsigned long last = READ_ONCE(ipd->last_touch_jiffies);
+
+	if (last == 0 || time_after_eq(jiffies, last + interval))
+		return 0;
+
+	return last + interval - jiffies;
+}
+
 static void read_power_status(uint8_t *buf)
 {
 	struct file *f = NULL;
@@ -184,7 +212,14 @@ static void read_power_status(uint8_t *buf)
 static void ilitek_platform_vpower_notify(struct work_struct *pWork)
 {
 	uint8_t charge_status[20] = { 0 };
+	unsigned long delay = ilitek_platform_touch_backoff(ipd->work_delay);
 
+	if (delay) {
+		ipio_debug(DEBUG_BATTERY, "Touch is active, check again in %lu jiffies\n", delay);
+		goto out;
+	}
+
+	delay = ipd->work_delay;
 	ipio_debug(DEBUG_BATTERY, "isEnableCheckPower = %d\n", ipd->isEnablePollCheckPower);
 	read_power_status(charge_status);
 	ipio_debug(DEBUG_BATTERY, "Batter Status: %s\n", charge_status);
@@ -200,8 +235,9 @@ static void ilitek_platform_vpower_notify(struct work_struct *pWork)
 	}
 /* Huaqin modify for ZQL1830-1463 by liufurong at 10181030 end */
 
+out:
 	if (ipd->isEnablePollCheckPower)
-		queue_delayed_work(ipd->check_power_status_queue, &ipd->check_power_status_work, ipd->work_delay);
+		queue_delayed_work(ipd->check_power_status_queue, &ipd->check_power_status_work, delay);
 }
 #endif
 
@@ -286,9 +322,7 @@ static void ilitek_platform_early_suspend(struct early_suspend *h)
 
 	/* TODO: there is doing nothing if an upgrade firmware's processing. */
 
-	core_fr_touch_release(0, 0, 0);
-
-	input_sync(core_fr->input_device);
+	core_fr_touch_release_all();
 
 	core_fr->isEnableFR = false;
 
@@ -389,7 +423,25 @@ static int ilitek_platform_reg_suspend(void)
 	return res;
 }
 
-#ifndef USE_KTHREAD
+#if defined (USE_KTHREAD) || defined (USE_IRQ_THREAD)
+/*
+ * Apply the priority set by users to the current thread. It's called by
+ * the thread itself since the irq thread created by kernel isn't visible
+ * to the driver.
+ */
+static void ilitek_platform_set_thread_prio(int policy)
+{
+	struct sched_param param = {.sched_priority = ipd->irq_thread_prio };
+
+	if (current->rt_priority == ipd->irq_thread_prio && current->policy == policy)
+		return;
+
+	if (sched_setscheduler(current, policy, &param) < 0)
+		ipio_err("Failed to set priority (%d) of irq thread\n", ipd->irq_thread_prio);
+	else
+		ipio_info("Set priority of irq thread to %d\n", ipd->irq_thread_prio);
+}
+#else
 static void ilitek_platform_work_queue(struct work_struct *work)
 {
 	ipio_debug(DEBUG_IRQ, "work_queue: IRQ = %d\n", ipd->isEnableIRQ);
@@ -399,12 +451,26 @@ static void ilitek_platform_work_queue(struct work_struct *work)
 	if (!ipd->isEnableIRQ)
 		ilitek_platform_enable_irq();
 }
-#endif /* USE_KTHREAD */
+#endif
+
+/* Hard irq, only takes the timestamp before waking the irq thread up */
+static irqreturn_t ilitek_platform_irq_top_half(int irq, void *dev_id)
+{
+	core_latency_mark(LATENCY_IRQ);
+	return IRQ_WAKE_THREAD;
+}
 
 static irqreturn_t ilitek_platform_irq_handler(int irq, void *dev_id)
 {
 	ipio_debug(DEBUG_IRQ, "IRQ = %d\n", ipd->isEnableIRQ);
 
+#ifdef USE_IRQ_THREAD
+	/* The line stays masked by IRQF_ONESHOT until we return */
+	if (ipd->isEnableIRQ) {
+		ilitek_platform_set_thread_prio(SCHED_FIFO);
+		core_fr_handler();
+	}
+#else
 	if (ipd->isEnableIRQ) {
 		ilitek_platform_disable_irq();
 #ifdef USE_KTHREAD
@@ -414,6 +480,7 @@ static irqreturn_t ilitek_platform_irq_handler(int irq, void *dev_id)
 		schedule_work(&ipd->report_work_queue);
 #endif /* USE_KTHREAD */
 	}
+#endif /* USE_IRQ_THREAD */
 
 	return IRQ_HANDLED;
 }
@@ -486,15 +553,12 @@ static int kthread_handler(void *arg)
 	} else if (strcmp(str, "irq") == 0) {
 #ifdef USE_KTHREAD
 		/* IRQ event */
-		struct sched_param param = {.sched_priority = 4 };
-
-		sched_setscheduler(current, SCHED_RR, &param);
-
 		while (!kthread_should_stop() && !ipd->free_irq_thread) {
 			set_current_state(TASK_INTERRUPTIBLE);
 			wait_event_interruptible(waiter, ipd->irq_trigger);
 			ipd->irq_trigger = false;
 			set_current_state(TASK_RUNNING);
+			ilitek_platform_set_thread_prio(SCHED_RR);
 			core_fr_handler();
 			ilitek_platform_enable_irq();
 		}
@@ -511,6 +575,8 @@ static int ilitek_platform_isr_register(void)
 {
 	int res = 0;
 
+	ipd->irq_thread_prio = IRQ_THREAD_PRIO;
+
 #ifdef USE_KTHREAD
 	ipd->irq_thread = kthread_run(kthread_handler, "irq", "ili_irq_thread");
 	if (ipd->irq_thread == (struct task_struct *)ERR_PTR) {
@@ -521,7 +587,7 @@ static int ilitek_platform_isr_register(void)
 	}
 	ipd->irq_trigger = false;
 	ipd->free_irq_thread = false;
-#else
+#elif !defined(USE_IRQ_THREAD)
 	INIT_WORK(&ipd->report_work_queue, ilitek_platform_work_queue);
 #endif /* USE_KTHREAD */
 
@@ -530,7 +596,7 @@ static int ilitek_platform_isr_register(void)
 	ipio_info("ipd->isr_gpio = %d\n", ipd->isr_gpio);
 
 	res = request_threaded_irq(ipd->isr_gpio,
-				   NULL,
+				   ilitek_platform_irq_top_half,
 				   ilitek_platform_irq_handler, IRQF_TRIGGER_FALLING | IRQF_ONESHOT, "ilitek", NULL);
 
 	if (res != 0) {
@@ -599,6 +665,68 @@ out:
 	return res;
 }
 
+/*
+ * Optional properties to fit the coordinate to a panel, and the default
+ * set at common.h is used if they're not present.
+ */
+static void ilitek_platform_axis(void)
+{
+#ifdef CONFIG_OF
+	struct device_node *dev_node = ipd->client->dev.of_node;
+	uint32_t val = 0;
+
+	if (dev_node == NULL)
+		return;
+
+	core_fr->isSwapXY = of_property_read_bool(dev_node, DTS_SWAP_XY);
+	core_fr->isInvertX = of_property_read_bool(dev_node, DTS_INVERT_X);
+	core_fr->isInvertY = of_property_read_bool(dev_node, DTS_INVERT_Y);
+
+	if (of_property_read_u32(dev_node, DTS_OFFSET_X, &val) == 0)
+		core_fr->offset_x = (int32_t)val;
+	if (of_property_read_u32(dev_node, DTS_OFFSET_Y, &val) == 0)
+		core_fr->offset_y = (int32_t)val;
+	if (of_property_read_u32(dev_node, DTS_SCREEN_X, &val) == 0 && val > 0)
+		core_fr->screen_x = val;
+	if (of_property_read_u32(dev_node, DTS_SCREEN_Y, &val) == 0 && val > 0)
+		core_fr->screen_y = val;
+#endif /* CONFIG_OF */
+
+	ipio_info("axis: swap = %d, invert = %d/%d, offset = %d/%d, screen = %dx%d\n",
+		core_fr->isSwapXY, core_fr->isInvertX, core_fr->isInvertY,
+		core_fr->offset_x, core_fr->offset_y, core_fr->screen_x, core_fr->screen_y);
+}
+
+/*
+ * Optional property to pick the backend of R/W with IC, it stays with i2c
+ * if it's not present or the backend fails to init. The length from which
+ * i2c messages are sent by DMA can be set as well.
+ */
+static void ilitek_platform_bus(void)
+{
+#ifdef CONFIG_OF
+	struct device_node *dev_node = ipd->client->dev.of_node;
+	const char *name = NULL;
+#ifdef I2C_DMA_SAFE
+	uint32_t val = 0;
+#endif
+
+	if (dev_node == NULL)
+		return;
+
+#ifdef I2C_DMA_SAFE
+	if (of_property_read_u32(dev_node, DTS_DMA_THRESHOLD, &val) == 0 && val > 0)
+		core_i2c->dma_threshold = min_t(uint32_t, val, U16_MAX);
+#endif /* I2C_DMA_SAFE */
+
+	if (of_property_read_string(dev_node, DTS_BUS, &name) < 0)
+		return;
+
+	if (core_protocol_set_bus(name) < 0)
+		ipio_err("Failed to use bus (%s), stay with %s\n", name, core_bus->name);
+#endif /* CONFIG_OF */
+}
+
 int ilitek_platform_read_tp_info(void)
 {
 /* huaqin modify for ZQL1830-1529 by liufurong at 20181101 start */
@@ -660,10 +788,18 @@ static int ilitek_platform_core_init(void)
 		return -EINVAL;
 	}
 
+	if (core_latency_init() < 0)
+		ipio_err("Failed to initialise latency statistics\n");
+
+	if (core_heatmap_init() < 0)
+		ipio_err("Failed to initialise heatmap\n");
+
 	if (core_i2c_init(ipd->client) < 0) {
 		ipio_err("Failed to initialise interface\n");
 		return -EINVAL;
 	}
+
+	ilitek_platform_bus();
 	return 0;
 }
 
@@ -696,6 +832,17 @@ static int ilitek_platform_remove(struct i2c_client *client)
 	}
 #endif /* USE_KTHREAD */
 
+	/* The emulated IC raises its events by itself */
+	core_emu_remove();
+
+	/* nothing can reach the frame pool from users after these */
+	ilitek_proc_remove();
+	ilitek_stream_remove();
+	ilitek_v4l2_remove();
+
+	core_latency_remove();
+	core_fr_remove();
+
 	if (ipd->input_device != NULL) {
 		input_unregister_device(ipd->input_device);
 		input_free_device(ipd->input_device);
@@ -711,7 +858,9 @@ static int ilitek_platform_remove(struct i2c_client *client)
 		destroy_workqueue(ipd->check_esd_status_queue);
 	}
 
-	ilitek_proc_remove();
+	/* no one can reach the bus from here on */
+	core_firmware_remove();
+	core_i2c_remove();
 	return 0;
 }
 
@@ -911,7 +1060,10 @@ static int ilitek_platform_probe(struct i2c_client *client, const struct i2c_dev
 	mutex_init(&ipd->ilitek_debug_mutex);
 	mutex_init(&ipd->ilitek_debug_read_mutex);
 	init_waitqueue_head(&(ipd->inq));
-	ipd->debug_data_frame = 0;
+	spin_lock_init(&ipd->debug_ring_lock);
+	ipd->debug_ring = NULL;
+	ipd->debug_ring_size = DEBUG_RING_SIZE;
+	ipd->debug_binary = false;
 	ipd->debug_node_open = false;
 
 #ifdef REGULATOR_POWER_ON
@@ -953,6 +1105,8 @@ static int ilitek_platform_probe(struct i2c_client *client, const struct i2c_dev
 		goto out_core_init_fail;
 	}
 
+	ilitek_platform_axis();
+
 	ilitek_platform_tp_hw_reset(true);
 
 	/* get our tp ic information */
@@ -982,6 +1136,8 @@ static int ilitek_platform_probe(struct i2c_client *client, const struct i2c_dev
 		ipio_err("Failed to register esd check function\n");
 	/* Create nodes for users */
 	ilitek_proc_init();
+	ilitek_stream_init();
+	ilitek_v4l2_init();
 /* huaqin add for ito tset by liufurong at 20180725 start */
 	platform_device_register(&hwinfo_device);
 	ilitek_test_node_init(&hwinfo_device);
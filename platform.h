@@ -25,6 +25,23 @@
 #ifndef __PLATFORM_H
 #define __PLATFORM_H
 
+struct ilitek_debug_ring;
+
+/*
+ * The header of each packet in the debug ring, which is also what users get
+ * in front of each packet in binary mode, and what a trace being replayed
+ * is made of.
+ *
+ * @dropped: the number of packets dropped by a full ring so far
+ */
+struct ilitek_debug_frame {
+	uint16_t len;
+	uint8_t pid;
+	uint8_t reserved;
+	uint32_t dropped;
+	uint64_t timestamp_ns;
+};
+
 struct ilitek_platform_data {
 
 	struct i2c_client *client;
@@ -59,9 +76,11 @@ struct ilitek_platform_data {
 	struct task_struct *irq_thread;
 	bool irq_trigger;
 	bool free_irq_thread;
-#else
+#elif !defined(USE_IRQ_THREAD)
 	struct work_struct report_work_queue;
 #endif
+	/* RT priority applied to the thread handling irq events */
+	int irq_thread_prio;
 
 #ifdef CONFIG_FB
 	struct notifier_block notifier_fb;
@@ -81,14 +100,21 @@ struct ilitek_platform_data {
 	struct work_struct esd_recovery;
 	unsigned long work_delay;
 	unsigned long esd_check_time;
+	/* jiffies of the last touch event, written by the irq path only */
+	unsigned long last_touch_jiffies;
 	bool vpower_reg_nb;
 	bool vesd_reg_nb;
 
 	/* Sending report data to users for the debug */
 	bool debug_node_open;
-	int debug_data_frame;
 	wait_queue_head_t inq;
-	unsigned char debug_buf[1024][2048];
+	/* only exists while the node is opened for reading */
+	struct ilitek_debug_ring *debug_ring;
+	uint32_t debug_ring_size;
+	/* read packets in binary rather than hex strings */
+	bool debug_binary;
+	/* guards debug_ring between irq path and open/release */
+	spinlock_t debug_ring_lock;
 	struct mutex ilitek_debug_mutex;
 	struct mutex ilitek_debug_read_mutex;
 	struct regulator *lcm_lab;
@@ -99,6 +125,11 @@ struct ilitek_platform_data {
 
 extern struct ilitek_platform_data *ipd;
 
+/* The default size of ring buffer keeping packets for the debug node */
+#define DEBUG_RING_SIZE		(256 * 1024)
+#define DEBUG_RING_MIN		(4 * 1024)
+#define DEBUG_RING_MAX		(4 * 1024 * 1024)
+
 /* exported from platform.c */
 extern void ilitek_platform_disable_irq(void);
 extern void ilitek_platform_enable_irq(void);
@@ -110,7 +141,24 @@ extern void ilitek_regulator_power_on(bool status);
 
 /* exported from userspsace.c */
 extern void netlink_reply_msg(void *raw, int size);
+extern void ilitek_debug_ring_push(uint8_t *data, uint16_t len);
 extern int ilitek_proc_init(void);
 extern void ilitek_proc_remove(void);
 
+/* exported from stream.c */
+extern void ilitek_stream_push(uint8_t *data, uint16_t len);
+extern int ilitek_stream_init(void);
+extern void ilitek_stream_remove(void);
+
+/* exported from v4l2.c */
+#ifdef TOUCH_V4L2
+extern void ilitek_v4l2_push(uint8_t *data, uint16_t len);
+extern int ilitek_v4l2_init(void);
+extern void ilitek_v4l2_remove(void);
+#else
+static inline void ilitek_v4l2_push(uint8_t *data, uint16_t len) {}
+static inline int ilitek_v4l2_init(void) { return 0; }
+static inline void ilitek_v4l2_remove(void) {}
+#endif /* TOUCH_V4L2 */
+
 #endif /* __PLATFORM_H */
@@ -0,0 +1,218 @@
+/*
+ * ILITEK Touch IC driver
+ *
+ * Copyright (C) 2011 ILI Technology Corporation.
+ *
+ * Author: Dicky Chiang <dicky_chiang@ilitek.com>
+ * Based on TDD v7.0 implemented by Mstar & ILITEK
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/ktime.h>
+
+#include "common.h"
+#include "platform.h"
+#include "stream.h"
+
+/*
+ * A char device exposing raw packets to users through a ring mapped into
+ * their memory, so a packet is written once by the irq path and read by
+ * users without any copies or formatting. The layout is in stream.h.
+ */
+#define STREAM_FRAME_NUM	256
+
+struct ilitek_stream {
+	void *buf;
+	size_t size;
+	struct ilitek_stream_hdr *hdr;
+	struct ilitek_stream_frame *frames;
+	bool opened;
+	struct mutex lock;
+	/* guards the ring between irq path and open/release */
+	spinlock_t ring_lock;
+	wait_queue_head_t wq;
+	bool registered;
+	/* seq of the next frame, hdr->head is only a copy users can't mess up */
+	uint32_t head;
+};
+
+static struct ilitek_stream g_stream;
+
+void ilitek_stream_push(uint8_t *data, uint16_t len)
+{
+	uint32_t seq;
+	struct ilitek_stream_frame *frame;
+
+	spin_lock(&g_stream.ring_lock);
+
+	if (g_stream.hdr == NULL)
+		goto out;
+
+	seq = g_stream.head;
+	frame = &g_stream.frames[seq & (STREAM_FRAME_NUM - 1)];
+	len = min_t(uint16_t, len, ILITEK_STREAM_FRAME_DATA);
+
+	/* mark it as busy before the content is changed */
+	WRITE_ONCE(frame->seq, ILITEK_STREAM_SEQ_BUSY);
+	smp_wmb();
+
+	memcpy(frame->data, data, len);
+	frame->len = len;
+	frame->pid = data[0];
+	frame->timestamp_ns = ktime_to_ns(ktime_get());
+
+	smp_wmb();
+	WRITE_ONCE(frame->seq, seq);
+	WRITE_ONCE(g_stream.head, seq + 1);
+	smp_store_release(&g_stream.hdr->head, seq + 1);
+
+out:
+	spin_unlock(&g_stream.ring_lock);
+	wake_up_interruptible(&g_stream.wq);
+}
+EXPORT_SYMBOL(ilitek_stream_push);
+
+static int ilitek_stream_open(struct inode *inode, struct file *filp)
+{
+	int res = 0;
+	void *buf = NULL;
+	size_t size = PAGE_ALIGN(sizeof(struct ilitek_stream_hdr)) +
+			PAGE_ALIGN(sizeof(struct ilitek_stream_frame) * STREAM_FRAME_NUM);
+
+	mutex_lock(&g_stream.lock);
+
+	if (g_stream.opened) {
+		ipio_err("stream is being used by others\n");
+		res = -EBUSY;
+		goto out;
+	}
+
+	buf = vmalloc_user(size);
+	if (ERR_ALLOC_MEM(buf)) {
+		ipio_err("Failed to allocate stream, size = %d\n", (int)size);
+		res = -ENOMEM;
+		goto out;
+	}
+
+	g_stream.buf = buf;
+	g_stream.size = size;
+	g_stream.frames = buf + PAGE_ALIGN(sizeof(struct ilitek_stream_hdr));
+
+	((struct ilitek_stream_hdr *)buf)->magic = ILITEK_STREAM_MAGIC;
+	((struct ilitek_stream_hdr *)buf)->version = ILITEK_STREAM_VERSION;
+	((struct ilitek_stream_hdr *)buf)->frame_size = sizeof(struct ilitek_stream_frame);
+	((struct ilitek_stream_hdr *)buf)->frame_num = STREAM_FRAME_NUM;
+	((struct ilitek_stream_hdr *)buf)->data_offset = PAGE_ALIGN(sizeof(struct ilitek_stream_hdr));
+
+	spin_lock(&g_stream.ring_lock);
+	g_stream.head = 0;
+	g_stream.hdr = buf;
+	spin_unlock(&g_stream.ring_lock);
+
+	g_stream.opened = true;
+	ipio_info("stream opened, size = %d\n", (int)size);
+
+out:
+	mutex_unlock(&g_stream.lock);
+	return res;
+}
+
+static int ilitek_stream_release(struct inode *inode, struct file *filp)
+{
+	mutex_lock(&g_stream.lock);
+
+	spin_lock(&g_stream.ring_lock);
+	g_stream.hdr = NULL;
+	spin_unlock(&g_stream.ring_lock);
+
+	/* It's no longer mapped by anyone since release comes after munmap */
+	vfree(g_stream.buf);
+	g_stream.buf = NULL;
+	g_stream.frames = NULL;
+	g_stream.opened = false;
+
+	mutex_unlock(&g_stream.lock);
+	return 0;
+}
+
+static int ilitek_stream_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	if (vma->vm_end - vma->vm_start + (vma->vm_pgoff << PAGE_SHIFT) > g_stream.size) {
+		ipio_err("mmap size is over the stream\n");
+		return -EINVAL;
+	}
+
+	return remap_vmalloc_range(vma, g_stream.buf, vma->vm_pgoff);
+}
+
+static unsigned int ilitek_stream_poll(struct file *filp, poll_table *wait)
+{
+	struct ilitek_stream_hdr *hdr = g_stream.buf;
+
+	poll_wait(filp, &g_stream.wq, wait);
+
+	if (READ_ONCE(g_stream.head) != READ_ONCE(hdr->tail))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+static const struct file_operations ilitek_stream_fops = {
+	.owner = THIS_MODULE,
+	.open = ilitek_stream_open,
+	.release = ilitek_stream_release,
+	.mmap = ilitek_stream_mmap,
+	.poll = ilitek_stream_poll,
+};
+
+static struct miscdevice ilitek_stream_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "ilitek_stream",
+	.fops = &ilitek_stream_fops,
+};
+
+int ilitek_stream_init(void)
+{
+	int res = 0;
+
+	mutex_init(&g_stream.lock);
+	spin_lock_init(&g_stream.ring_lock);
+	init_waitqueue_head(&g_stream.wq);
+
+	res = misc_register(&ilitek_stream_dev);
+	if (res < 0) {
+		ipio_err("Failed to register stream device, res = %d\n", res);
+		return res;
+	}
+
+	g_stream.registered = true;
+	return res;
+}
+EXPORT_SYMBOL(ilitek_stream_init);
+
+void ilitek_stream_remove(void)
+{
+	if (!g_stream.registered)
+		return;
+
+	misc_deregister(&ilitek_stream_dev);
+	g_stream.registered = false;
+}
+EXPORT_SYMBOL(ilitek_stream_remove);
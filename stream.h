@@ -0,0 +1,71 @@
+/*
+ * ILITEK Touch IC driver
+ *
+ * Copyright (C) 2011 ILI Technology Corporation.
+ *
+ * Author: Dicky Chiang <dicky_chiang@ilitek.com>
+ * Based on TDD v7.0 implemented by Mstar & ILITEK
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef __ILITEK_STREAM_H
+#define __ILITEK_STREAM_H
+
+/*
+ * Layout of /dev/ilitek_stream shared with users through mmap, this file
+ * can be included by user space tools as it is.
+ *
+ * The first page holds struct ilitek_stream_hdr, followed by frame_num
+ * slots of frame_size bytes from data_offset, each one is struct
+ * ilitek_stream_frame.
+ *
+ * The ring is overwritten if users don't keep up. A slot being written
+ * has seq of ILITEK_STREAM_SEQ_BUSY, so users can check seq again after
+ * reading a slot to know whether it was overwritten meanwhile. Users only
+ * write tail, with the seq of next frame they want, which poll() compares
+ * with head. Writing anything else in the header has no effect on driver.
+ */
+
+#include <linux/types.h>
+
+#define ILITEK_STREAM_MAGIC		0x494C5354	/* "ILST" */
+#define ILITEK_STREAM_VERSION		1
+#define ILITEK_STREAM_FRAME_DATA	2048
+#define ILITEK_STREAM_SEQ_BUSY		0xFFFFFFFF
+
+struct ilitek_stream_hdr {
+	__u32 magic;
+	__u32 version;
+	__u32 frame_size;
+	__u32 frame_num;
+	__u32 data_offset;
+	/* seq of the next frame, a copy of what driver keeps for itself */
+	__u32 head;
+	/* seq of the next frame wanted by users, written by users */
+	__u32 tail;
+};
+
+struct ilitek_stream_frame {
+	__u32 seq;
+	__u16 len;
+	__u8 pid;
+	__u8 reserved;
+	__u64 timestamp_ns;
+	__u8 data[ILITEK_STREAM_FRAME_DATA];
+};
+
+#endif /* __ILITEK_STREAM_H */
@@ -33,6 +33,8 @@
 #include "core/mp_test.h"
 #include "core/parser.h"
 #include "core/gesture.h"
+#include "core/heatmap.h"
+#include "core/emu.h"
 #include "core/mp_test.h"
 
 #define USER_STR_BUFF	128
@@ -136,6 +138,206 @@ int str2hex(char *str)
 }
 EXPORT_SYMBOL(str2hex);
 
+/*
+ * A single producer/single consumer ring keeping packets for the debug node.
+ * Each record is struct ilitek_debug_frame followed by the packet. Indexes
+ * run freely and are masked with the size, which is a power of 2.
+ *
+ * The producer (irq path) only writes head and the consumer (reader) only
+ * writes tail, so neither of them waits for the other. A full ring drops
+ * new packets rather than blocking the irq path.
+ */
+struct ilitek_debug_ring {
+	uint32_t size;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t dropped;
+	/* a packet taken out of the ring for the reader */
+	uint8_t frame[2048];
+	uint8_t data[0];
+};
+
+#define DEBUG_RING_HDR	sizeof(struct ilitek_debug_frame)
+
+static void debug_ring_copy_in(struct ilitek_debug_ring *ring, uint32_t pos, uint8_t *src, uint32_t len)
+{
+	uint32_t off = pos & (ring->size - 1);
+	uint32_t first = min(len, ring->size - off);
+
+	memcpy(ring->data + off, src, first);
+	memcpy(ring->data, src + first, len - first);
+}
+
+static void debug_ring_copy_out(struct ilitek_debug_ring *ring, uint32_t pos, uint8_t *dst, uint32_t len)
+{
+	uint32_t off = pos & (ring->size - 1);
+	uint32_t first = min(len, ring->size - off);
+
+	memcpy(dst, ring->data + off, first);
+	memcpy(dst + first, ring->data, len - first);
+}
+
+void ilitek_debug_ring_push(uint8_t *data, uint16_t len)
+{
+	uint32_t head, tail;
+	struct ilitek_debug_frame hdr;
+	struct ilitek_debug_ring *ring;
+
+	spin_lock(&ipd->debug_ring_lock);
+
+	ring = ipd->debug_ring;
+	if (ring == NULL)
+		goto out;
+
+	head = ring->head;
+	tail = smp_load_acquire(&ring->tail);
+
+	if (len > sizeof(ring->frame) || ring->size - (head - tail) < len + DEBUG_RING_HDR) {
+		ring->dropped++;
+		ipio_debug(DEBUG_FINGER_REPORT, "debug ring is full, dropped = %d\n", ring->dropped);
+		goto out;
+	}
+
+	hdr.len = len;
+	hdr.pid = data[0];
+	hdr.reserved = 0;
+	hdr.dropped = ring->dropped;
+	hdr.timestamp_ns = ktime_to_ns(ktime_get());
+	debug_ring_copy_in(ring, head, (uint8_t *)&hdr, DEBUG_RING_HDR);
+	debug_ring_copy_in(ring, head + DEBUG_RING_HDR, data, len);
+
+	/* publish the record after it's entirely written */
+	smp_store_release(&ring->head, head + DEBUG_RING_HDR + len);
+
+out:
+	spin_unlock(&ipd->debug_ring_lock);
+
+	if (ring != NULL)
+		wake_up(&ipd->inq);
+}
+EXPORT_SYMBOL(ilitek_debug_ring_push);
+
+static bool debug_ring_empty(struct ilitek_debug_ring *ring)
+{
+	return smp_load_acquire(&ring->head) == ring->tail;
+}
+
+/*
+ * Copy the oldest packet into ring->frame without removing it.
+ * Return the length of packet, 0 if the ring is empty.
+ */
+static uint16_t debug_ring_peek(struct ilitek_debug_ring *ring, struct ilitek_debug_frame *hdr)
+{
+	uint32_t tail = ring->tail;
+
+	if (debug_ring_empty(ring))
+		return 0;
+
+	debug_ring_copy_out(ring, tail, (uint8_t *)hdr, DEBUG_RING_HDR);
+	debug_ring_copy_out(ring, tail + DEBUG_RING_HDR, ring->frame, hdr->len);
+
+	return hdr->len;
+}
+
+/* Remove the oldest packet, so that producer is able to reuse its space */
+static void debug_ring_skip(struct ilitek_debug_ring *ring, uint16_t len)
+{
+	smp_store_release(&ring->tail, ring->tail + DEBUG_RING_HDR + len);
+}
+
+/*
+ * Binary mode returns as many whole packets as the size of buffer can hold,
+ * each of them follows struct ilitek_debug_frame.
+ */
+static ssize_t debug_message_read_binary(struct ilitek_debug_ring *ring, char __user *buff, size_t size)
+{
+	size_t total = 0;
+	uint16_t len = 0;
+	struct ilitek_debug_frame hdr;
+
+	while ((len = debug_ring_peek(ring, &hdr)) > 0) {
+		if (total + DEBUG_RING_HDR + len > size)
+			break;
+
+		if (copy_to_user(buff + total, &hdr, DEBUG_RING_HDR) ||
+			copy_to_user(buff + total + DEBUG_RING_HDR, ring->frame, len)) {
+			ipio_err("Failed to copy data to user space\n");
+			return total ? total : -EFAULT;
+		}
+
+		debug_ring_skip(ring, len);
+		total += DEBUG_RING_HDR + len;
+	}
+
+	if (total == 0) {
+		ipio_err("Buffer (%d) is too small for a packet (%d)\n", (int)size, (int)(DEBUG_RING_HDR + len));
+		return -EINVAL;
+	}
+
+	return total;
+}
+
+static int ilitek_proc_debug_message_open(struct inode *inode, struct file *filp)
+{
+	int res = 0;
+	struct ilitek_debug_ring *ring = NULL;
+
+	/* Only readers need the ring, the node is also written to switch the flag */
+	if (!(filp->f_mode & FMODE_READ))
+		return 0;
+
+	mutex_lock(&ipd->ilitek_debug_mutex);
+
+	if (ipd->debug_ring != NULL) {
+		ipio_err("debug message is being read by others\n");
+		res = -EBUSY;
+		goto out;
+	}
+
+	ring = vzalloc(sizeof(*ring) + ipd->debug_ring_size);
+	if (ERR_ALLOC_MEM(ring)) {
+		ipio_err("Failed to allocate debug ring, size = %d\n", ipd->debug_ring_size);
+		res = -ENOMEM;
+		goto out;
+	}
+
+	ring->size = ipd->debug_ring_size;
+
+	spin_lock(&ipd->debug_ring_lock);
+	ipd->debug_ring = ring;
+	spin_unlock(&ipd->debug_ring_lock);
+
+	ipio_info("debug ring size = %d\n", ring->size);
+
+out:
+	mutex_unlock(&ipd->ilitek_debug_mutex);
+	return res;
+}
+
+static int ilitek_proc_debug_message_release(struct inode *inode, struct file *filp)
+{
+	struct ilitek_debug_ring *ring = NULL;
+
+	if (!(filp->f_mode & FMODE_READ))
+		return 0;
+
+	mutex_lock(&ipd->ilitek_debug_mutex);
+
+	/* No producer touches the ring once it's detached */
+	spin_lock(&ipd->debug_ring_lock);
+	ring = ipd->debug_ring;
+	ipd->debug_ring = NULL;
+	spin_unlock(&ipd->debug_ring_lock);
+
+	if (ring != NULL) {
+		ipio_info("debug ring released, dropped = %d\n", ring->dropped);
+		vfree(ring);
+	}
+
+	mutex_unlock(&ipd->ilitek_debug_mutex);
+	return 0;
+}
+
 static ssize_t ilitek_proc_debug_switch_read(struct file *pFile, char __user *buff, size_t nCount, loff_t *pPos)
 {
 	int res = 0;
@@ -161,9 +363,42 @@ static ssize_t ilitek_proc_debug_switch_read(struct file *pFile, char __user *bu
 	return nCount;
 }
 
+static ssize_t ilitek_proc_debug_switch_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	char cmd[10] = { 0 };
+
+	if (size > sizeof(cmd)) {
+		ipio_err("Size is larger than the length of cmd\n");
+		goto out;
+	}
+
+	if (buff != NULL) {
+		res = copy_from_user(cmd, buff, size - 1);
+		if (res < 0) {
+			ipio_info("copy data from user space, failed\n");
+			return -1;
+		}
+	}
+
+	if (strcmp(cmd, "binary") == 0) {
+		ipd->debug_binary = true;
+	} else if (strcmp(cmd, "text") == 0) {
+		ipd->debug_binary = false;
+	} else {
+		ipio_err("Unknown command\n");
+		goto out;
+	}
+
+	ipio_info("debug message is read in %s mode\n", ipd->debug_binary ? "binary" : "text");
+
+out:
+	return size;
+}
+
 static ssize_t ilitek_proc_debug_message_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
 {
-	int ret = 0;
+	int ret = 0, ring_size = 0;
 	unsigned char buffer[512] = { 0 };
 
 	/* check the buffer size whether it exceeds the local buffer size or not */
@@ -182,6 +417,12 @@ static ssize_t ilitek_proc_debug_message_write(struct file *filp, const char *bu
 		ipd->debug_node_open = !ipd->debug_node_open;
 		ipio_info(" %s debug_flag message(%X).\n", ipd->debug_node_open ? "Enabled" : "Disabled",
 			 ipd->debug_node_open);
+	} else if (strncmp(buffer, "ring_size=", 10) == 0) {
+		/* Taken effect at next time the node is opened for reading */
+		ring_size = katoi(buffer + 10);
+		ring_size = clamp_t(int, ring_size, DEBUG_RING_MIN, DEBUG_RING_MAX);
+		ipd->debug_ring_size = roundup_pow_of_two(ring_size);
+		ipio_info("debug ring size = %d\n", ipd->debug_ring_size);
 	}
 	return size;
 }
@@ -193,50 +434,60 @@ static ssize_t ilitek_proc_debug_message_read(struct file *filp, char __user *bu
 	int i = 0;
 	int send_data_len = 0;
 	size_t ret = 0;
-	int data_count = 0;
-	int one_data_bytes = 0;
 	int need_read_data_len = 0;
-	int type = 0;
+	uint16_t len = 0;
 	unsigned char *tmpbuf = NULL;
 	unsigned char tmpbufback[128] = { 0 };
+	struct ilitek_debug_frame hdr;
+	struct ilitek_debug_ring *ring = ipd->debug_ring;
+
+	if (ring == NULL) {
+		ipio_err("debug ring isn't allocated\n");
+		return -EINVAL;
+	}
 
 	mutex_lock(&ipd->ilitek_debug_read_mutex);
 
-	while (ipd->debug_data_frame <= 0) {
+	while (debug_ring_empty(ring)) {
 		if (filp->f_flags & O_NONBLOCK) {
+			mutex_unlock(&ipd->ilitek_debug_read_mutex);
 			return -EAGAIN;
 		}
-		wait_event_interruptible(ipd->inq, ipd->debug_data_frame > 0);
+		if (wait_event_interruptible(ipd->inq, !debug_ring_empty(ring))) {
+			mutex_unlock(&ipd->ilitek_debug_read_mutex);
+			return -ERESTARTSYS;
+		}
 	}
 
-	mutex_lock(&ipd->ilitek_debug_mutex);
+	if (ipd->debug_binary) {
+		ret = debug_message_read_binary(ring, buff, size);
+		mutex_unlock(&ipd->ilitek_debug_read_mutex);
+		return ret;
+	}
 
 	tmpbuf = vmalloc(4096);	/* buf size if even */
 	if (ERR_ALLOC_MEM(tmpbuf)) {
 		ipio_err("buffer vmalloc error\n");
 		send_data_len += sprintf(tmpbufback + send_data_len, "buffer vmalloc error\n");
-		ret = copy_to_user(buff, tmpbufback, send_data_len); /*ipd->debug_buf[0] */
+		ret = copy_to_user(buff, tmpbufback, send_data_len);
 	} else {
-		if (ipd->debug_data_frame > 0) {
-			if (ipd->debug_buf[0][0] == 0x5A) {
-				need_read_data_len = 43;
-			} else if (ipd->debug_buf[0][0] == 0x7A) {
-				type = ipd->debug_buf[0][3] & 0x0F;
-
-				data_count = ipd->debug_buf[0][1] * ipd->debug_buf[0][2];
-
-				if (type == 0 || type == 1 || type == 6) {
-					one_data_bytes = 1;
-				} else if (type == 2 || type == 3) {
-					one_data_bytes = 2;
-				} else if (type == 4 || type == 5) {
-					one_data_bytes = 4;
-				}
-				need_read_data_len = data_count * one_data_bytes + 1 + 5;
-			}
-
-			send_data_len = 0;	/* ipd->debug_buf[0][1] - 2; */
+		len = debug_ring_peek(ring, &hdr);
+		memset(ring->frame + len, 0x0, sizeof(ring->frame) - len);
+
+		/* The packet is only consumed by the read with these sizes or offset */
+		if (len > 0 && (p == 5 || size == 4096 || size == 2048))
+			debug_ring_skip(ring, len);
+
+		if (len > 0) {
+			/*
+			 * i2cuart packets are already whole in the ring, their real length
+			 * is core_fr_i2cuart_data_len() + 5, but tools expect 2040 bytes.
+			 */
+			send_data_len = 0;
 			need_read_data_len = 2040;
+			if (ring->frame[0] == protocol->i2cuart_pid)
+				ipio_debug(DEBUG_FINGER_REPORT, "i2cuart packet, data len = %d\n",
+					core_fr_i2cuart_data_len(ring->frame));
 			if (need_read_data_len <= 0) {
 				ipio_err("parse data err data len = %d\n", need_read_data_len);
 				send_data_len +=
@@ -244,7 +495,7 @@ static ssize_t ilitek_proc_debug_message_read(struct file *filp, char __user *bu
 					    need_read_data_len);
 			} else {
 				for (i = 0; i < need_read_data_len; i++) {
-					send_data_len += sprintf(tmpbuf + send_data_len, "%02X", ipd->debug_buf[0][i]);
+					send_data_len += sprintf(tmpbuf + send_data_len, "%02X", ring->frame[i]);
 					if (send_data_len >= 4096) {
 						ipio_err("send_data_len = %d set 4096 i = %d\n", send_data_len, i);
 						send_data_len = 4096;
@@ -253,17 +504,6 @@ static ssize_t ilitek_proc_debug_message_read(struct file *filp, char __user *bu
 				}
 			}
 			send_data_len += sprintf(tmpbuf + send_data_len, "\n\n");
-
-			if (p == 5 || size == 4096 || size == 2048) {
-				ipd->debug_data_frame--;
-				if (ipd->debug_data_frame < 0) {
-					ipd->debug_data_frame = 0;
-				}
-
-				for (i = 1; i <= ipd->debug_data_frame; i++) {
-					memcpy(ipd->debug_buf[i - 1], ipd->debug_buf[i], 2048);
-				}
-			}
 		} else {
 			ipio_err("no data send\n");
 			send_data_len += sprintf(tmpbuf + send_data_len, "no data send\n");
@@ -294,7 +534,6 @@ static ssize_t ilitek_proc_debug_message_read(struct file *filp, char __user *bu
 		tmpbuf = NULL;
 	}
 
-	mutex_unlock(&ipd->ilitek_debug_mutex);
 	mutex_unlock(&ipd->ilitek_debug_read_mutex);
 	return send_data_len;
 }
@@ -376,6 +615,7 @@ static ssize_t ilitek_proc_oppo_mp_lcm_off_read(struct file *filp, char __user *
 	/* Enter to suspend and move gesture code to iram */
 	core_config->isEnableGesture = true;
 	core_gesture->mode = GESTURE_INFO_MPDE;
+	core_fr_update_len_table();
 
 	/* sense stop */
 	core_config_sense_ctrl(false);
@@ -659,72 +899,602 @@ static ssize_t ilitek_proc_mp_test_write(struct file *filp, const char *buff, si
 		return size;
 	}
 
-	/* Switch to Test mode */
-	core_fr_mode_control(&protocol->test_mode);
+	/* Switch to Test mode */
+	core_fr_mode_control(&protocol->test_mode);
+
+	ilitek_platform_disable_irq();
+
+	for (i = 0; i < core_mp->mp_items; i++) {
+		if (strcmp(cmd, tItems[i].name) == 0) {
+			strcpy(str, tItems[i].desp);
+			tItems[i].run = 1;
+			tItems[i].max = va[1];
+			tItems[i].min = va[2];
+			tItems[i].frame_count = va[3];
+			break;
+		}
+	}
+
+	core_mp_run_test(str, false);
+
+	core_mp_show_result();
+
+	core_mp_test_free();
+
+	core_config_ice_mode_enable();
+
+	if (core_config_set_watch_dog(false) < 0) {
+		ipio_err("Failed to disable watch dog\n");
+	}
+
+	core_config_ic_reset();
+
+	core_fr_mode_control(&protocol->demo_mode);
+
+	ilitek_platform_enable_irq();
+
+	ipio_info("MP Test DONE\n");
+	ipio_kfree((void **)&va);
+	return size;
+}
+
+static ssize_t ilitek_proc_debug_level_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	uint32_t len = 0;
+
+	if (*pPos != 0)
+		return 0;
+
+	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
+
+	len = sprintf(g_user_buf, "%d", ipio_debug_level);
+
+	ipio_info("Current DEBUG Level = %d\n", ipio_debug_level);
+	ipio_info("You can set one of levels for debug as below:\n");
+	ipio_info("DEBUG_NONE = %d\n", DEBUG_NONE);
+	ipio_info("DEBUG_IRQ = %d\n", DEBUG_IRQ);
+	ipio_info("DEBUG_FINGER_REPORT = %d\n", DEBUG_FINGER_REPORT);
+	ipio_info("DEBUG_FIRMWARE = %d\n", DEBUG_FIRMWARE);
+	ipio_info("DEBUG_CONFIG = %d\n", DEBUG_CONFIG);
+	ipio_info("DEBUG_I2C = %d\n", DEBUG_I2C);
+	ipio_info("DEBUG_BATTERY = %d\n", DEBUG_BATTERY);
+	ipio_info("DEBUG_MP_TEST = %d\n", DEBUG_MP_TEST);
+	ipio_info("DEBUG_IOCTL = %d\n", DEBUG_IOCTL);
+	ipio_info("DEBUG_NETLINK = %d\n", DEBUG_NETLINK);
+	ipio_info("DEBUG_ALL = %d\n", DEBUG_ALL);
+
+	res = copy_to_user((uint32_t *) buff, &ipio_debug_level, len);
+	if (res < 0) {
+		ipio_err("Failed to copy data to user space\n");
+	}
+
+	*pPos = len;
+
+	return len;
+}
+
+static ssize_t ilitek_proc_debug_level_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	char cmd[10] = { 0 };
+
+	if (buff != NULL) {
+		res = copy_from_user(cmd, buff, size - 1);
+		if (res < 0) {
+			ipio_info("copy data from user space, failed\n");
+			return -1;
+		}
+	}
+
+	ipio_debug_level = katoi(cmd);
+
+	ipio_info("ipio_debug_level = %d\n", ipio_debug_level);
+
+	return size;
+}
+
+static ssize_t ilitek_proc_gesture_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	uint32_t len = 0;
+
+	if (*pPos != 0)
+		return 0;
+
+	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
+
+	len = sprintf(g_user_buf, "%d", core_config->isEnableGesture);
+
+	ipio_info("isEnableGesture = %d\n", core_config->isEnableGesture);
+
+	res = copy_to_user((uint32_t *) buff, &core_config->isEnableGesture, len);
+	if (res < 0) {
+		ipio_err("Failed to copy data to user space\n");
+	}
+
+	*pPos = len;
+
+	return len;
+}
+
+static ssize_t ilitek_proc_gesture_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	char cmd[10] = { 0 };
+
+	if (buff != NULL) {
+		res = copy_from_user(cmd, buff, size - 1);
+		if (res < 0) {
+			ipio_info("copy data from user space, failed\n");
+			return -1;
+		}
+	}
+
+	ipio_info("size = %d, cmd = %s\n", (int)size, cmd);
+
+	if (strcmp(cmd, "on") == 0) {
+		ipio_info("enable gesture mode\n");
+		core_config->isEnableGesture = true;
+	} else if (strcmp(cmd, "off") == 0) {
+		ipio_info("disable gesture mode\n");
+		core_config->isEnableGesture = false;
+	} else if (strcmp(cmd, "info") == 0) {
+		ipio_info("gesture info mode\n");
+		core_gesture->mode = GESTURE_INFO_MPDE;
+		core_fr_update_len_table();
+	} else if (strcmp(cmd, "normal") == 0) {
+		ipio_info("gesture normal mode\n");
+		core_gesture->mode = GESTURE_NORMAL_MODE;
+		core_fr_update_len_table();
+	} else
+		ipio_err("Unknown command\n");
+
+	return size;
+}
+
+static ssize_t ilitek_proc_check_battery_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	uint32_t len = 0;
+
+	if (*pPos != 0)
+		return 0;
+
+	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
+
+	len = sprintf(g_user_buf, "%d", ipd->isEnablePollCheckPower);
+
+	ipio_info("isEnablePollCheckPower = %d\n", ipd->isEnablePollCheckPower);
+
+	res = copy_to_user((uint32_t *) buff, &ipd->isEnablePollCheckPower, len);
+	if (res < 0) {
+		ipio_err("Failed to copy data to user space\n");
+	}
+
+	*pPos = len;
+
+	return len;
+}
+
+static ssize_t ilitek_proc_check_battery_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	char cmd[10] = { 0 };
+
+	if (size > sizeof(cmd)) {
+		ipio_err("Size is larger than the length of cmd\n");
+		goto out;
+	}
+
+	if (ipd->check_power_status_queue == NULL) {
+		ipio_err("work queue isn't created, do nothing\n");
+		goto out;
+	}
+
+	if (buff != NULL) {
+		res = copy_from_user(cmd, buff, size - 1);
+		if (res < 0) {
+			ipio_info("copy data from user space, failed\n");
+			return -1;
+		}
+	}
+
+	ipio_info("size = %d, cmd = %s\n", (int)size, cmd);
+
+	if (strcmp(cmd, "on") == 0) {
+		ipio_info("Start the thread of check power status\n");
+		queue_delayed_work(ipd->check_power_status_queue, &ipd->check_power_status_work, ipd->work_delay);
+		ipd->isEnablePollCheckPower = true;
+	} else if (strcmp(cmd, "off") == 0) {
+		ipio_info("Cancel the thread of check power status\n");
+		cancel_delayed_work_sync(&ipd->check_power_status_work);
+		ipd->isEnablePollCheckPower = false;
+	} else
+		ipio_err("Unknown command\n");
+
+out:
+	return size;
+}
+
+static ssize_t ilitek_proc_check_esd_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	uint32_t len = 0;
+
+	if (*pPos != 0)
+		return 0;
+
+	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
+
+	len = sprintf(g_user_buf, "%d", ipd->isEnablePollCheckEsd);
+
+	ipio_info("isEnablePollCheckEsd = %d\n", ipd->isEnablePollCheckEsd);
+
+	res = copy_to_user((uint32_t *) buff, &ipd->isEnablePollCheckEsd, len);
+	if (res < 0) {
+		ipio_err("Failed to copy data to user space\n");
+	}
+
+	*pPos = len;
+
+	return len;
+}
+
+static ssize_t ilitek_proc_check_esd_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	char cmd[10] = { 0 };
+
+	if (size > sizeof(cmd)) {
+		ipio_err("Size is larger than the length of cmd\n");
+		goto out;
+	}
+
+	if (ipd->check_esd_status_queue == NULL) {
+		ipio_err("work queue isn't created, do nothing\n");
+		goto out;
+	}
+
+	if (buff != NULL) {
+		res = copy_from_user(cmd, buff, size - 1);
+		if (res < 0) {
+			ipio_info("copy data from user space, failed\n");
+			return -1;
+		}
+	}
+
+	ipio_info("size = %d, cmd = %s\n", (int)size, cmd);
+
+	if (strcmp(cmd, "on") == 0) {
+		ipio_info("Start the thread of check esd status\n");
+		queue_delayed_work(ipd->check_esd_status_queue,
+			&ipd->check_esd_status_work, ipd->esd_check_time);
+		ipd->isEnablePollCheckEsd = true;
+	} else if (strcmp(cmd, "off") == 0) {
+		ipio_info("Cancel the thread of check esd status\n");
+		cancel_delayed_work_sync(&ipd->check_esd_status_work);
+		ipd->isEnablePollCheckEsd = false;
+	} else
+		ipio_err("Unknown command\n");
+
+out:
+	return size;
+}
+
+static ssize_t ilitek_proc_coalesce_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	uint32_t len = 0, cadence_us = 0;
+	struct core_fr_coalesce_stat stat;
+
+	if (*pPos != 0)
+		return 0;
+
+	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
+
+	core_fr_get_coalesce(&cadence_us, &stat);
+
+	/* cadence_us frames merged flushed */
+	len = sprintf(g_user_buf, "%d %d %d %d\n", cadence_us, stat.frames, stat.merged, stat.flushed);
+
+	res = copy_to_user(buff, g_user_buf, len);
+	if (res < 0) {
+		ipio_err("Failed to copy data to user space\n");
+	}
+
+	*pPos = len;
+
+	return len;
+}
+
+static ssize_t ilitek_proc_coalesce_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	char cmd[16] = { 0 };
+
+	if (size > sizeof(cmd)) {
+		ipio_err("Size is larger than the length of cmd\n");
+		goto out;
+	}
+
+	if (buff != NULL) {
+		res = copy_from_user(cmd, buff, size - 1);
+		if (res < 0) {
+			ipio_info("copy data from user space, failed\n");
+			return -1;
+		}
+	}
+
+	core_fr_set_coalesce(katoi(cmd));
+
+out:
+	return size;
+}
+
+static ssize_t ilitek_proc_predict_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	uint32_t len = 0, horizon_ms = 0, err_mean = 0;
+	struct core_fr_predict_stat stat;
+
+	if (*pPos != 0)
+		return 0;
+
+	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
+
+	core_fr_get_predict(&horizon_ms, &stat);
+	if (stat.samples > 0)
+		err_mean = (uint32_t)div_u64(stat.err_sum, stat.samples);
+
+	/* horizon_ms samples mean_error max_error */
+	len = sprintf(g_user_buf, "%d %d %d %d\n", horizon_ms, stat.samples, err_mean, stat.err_max);
+
+	res = copy_to_user(buff, g_user_buf, len);
+	if (res < 0) {
+		ipio_err("Failed to copy data to user space\n");
+	}
+
+	*pPos = len;
+
+	return len;
+}
+
+static ssize_t ilitek_proc_predict_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	char cmd[10] = { 0 };
+
+	if (size > sizeof(cmd)) {
+		ipio_err("Size is larger than the length of cmd\n");
+		goto out;
+	}
+
+	if (buff != NULL) {
+		res = copy_from_user(cmd, buff, size - 1);
+		if (res < 0) {
+			ipio_info("copy data from user space, failed\n");
+			return -1;
+		}
+	}
+
+	core_fr_set_predict(katoi(cmd));
+
+out:
+	return size;
+}
+
+#ifdef BUS_EMULATOR
+static ssize_t ilitek_proc_emu_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	uint32_t len = 0;
+	struct core_emu_stat stat;
+
+	if (*pPos != 0)
+		return 0;
+
+	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
+
+	core_emu_get_stat(&stat);
+
+	/* rate_hz frames writes reads */
+	len = sprintf(g_user_buf, "%d %d %d %d\n", stat.rate_hz, stat.frames, stat.writes, stat.reads);
+
+	res = copy_to_user(buff, g_user_buf, len);
+	if (res < 0) {
+		ipio_err("Failed to copy data to user space\n");
+	}
+
+	*pPos = len;
+
+	return len;
+}
+
+static ssize_t ilitek_proc_emu_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	char cmd[10] = { 0 };
+
+	if (size > sizeof(cmd)) {
+		ipio_err("Size is larger than the length of cmd\n");
+		goto out;
+	}
+
+	if (buff != NULL) {
+		res = copy_from_user(cmd, buff, size - 1);
+		if (res < 0) {
+			ipio_info("copy data from user space, failed\n");
+			return -1;
+		}
+	}
+
+	res = core_emu_set_rate(katoi(cmd));
+	if (res < 0)
+		return res;
+
+out:
+	return size;
+}
+#endif /* BUS_EMULATOR */
+
+#ifdef FR_REPLAY
+/*
+ * A trace written to the replay node is run through the parser as it comes,
+ * a chunk at a time, and the result is ready once the file is closed. A
+ * packet cut by the end of a write is kept until the next one.
+ */
+#define REPLAY_BUF_SIZE		(16 * 1024)
+
+static DEFINE_MUTEX(ilitek_replay_mutex);
+static uint8_t *g_replay_buf = NULL;
+static uint32_t g_replay_len = 0;
+static int g_replay_res = 0;
+static struct core_fr_replay_stat g_replay_stat;
+
+static int ilitek_proc_replay_open(struct inode *inode, struct file *filp)
+{
+	int res = 0;
+
+	if (!(filp->f_mode & FMODE_WRITE))
+		return 0;
+
+	mutex_lock(&ilitek_replay_mutex);
+
+	if (g_replay_buf != NULL) {
+		res = -EBUSY;
+		goto out;
+	}
+
+	g_replay_buf = kmalloc(REPLAY_BUF_SIZE, GFP_KERNEL);
+	if (ERR_ALLOC_MEM(g_replay_buf)) {
+		ipio_err("Failed to allocate replay buf mem\n");
+		g_replay_buf = NULL;
+		res = -ENOMEM;
+		goto out;
+	}
+
+	res = core_fr_replay_start();
+	if (res < 0) {
+		ipio_kfree((void **)&g_replay_buf);
+		goto out;
+	}
+
+	g_replay_len = 0;
+	g_replay_res = 0;
+
+out:
+	mutex_unlock(&ilitek_replay_mutex);
+	return res;
+}
+
+static ssize_t ilitek_proc_replay_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+{
+	int res = 0;
+	ssize_t ret = size;
+	size_t pos = 0, len = 0;
+
+	mutex_lock(&ilitek_replay_mutex);
+
+	if (g_replay_buf == NULL) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (g_replay_res < 0) {
+		ret = g_replay_res;
+		goto out;
+	}
+
+	while (pos < size) {
+		len = min_t(size_t, size - pos, REPLAY_BUF_SIZE - g_replay_len);
+		if (copy_from_user(g_replay_buf + g_replay_len, buff + pos, len)) {
+			ipio_err("Failed to copy data from user space\n");
+			ret = -EFAULT;
+			goto out;
+		}
 
-	ilitek_platform_disable_irq();
+		g_replay_len += len;
+		pos += len;
 
-	for (i = 0; i < core_mp->mp_items; i++) {
-		if (strcmp(cmd, tItems[i].name) == 0) {
-			strcpy(str, tItems[i].desp);
-			tItems[i].run = 1;
-			tItems[i].max = va[1];
-			tItems[i].min = va[2];
-			tItems[i].frame_count = va[3];
-			break;
+		res = core_fr_replay_feed(g_replay_buf, g_replay_len);
+		if (res == 0 && g_replay_len == REPLAY_BUF_SIZE) {
+			ipio_err("A packet in trace is larger than %d\n", REPLAY_BUF_SIZE);
+			res = -EINVAL;
 		}
-	}
 
-	core_mp_run_test(str, false);
-
-	core_mp_show_result();
+		if (res < 0) {
+			g_replay_res = res;
+			ret = res;
+			goto out;
+		}
 
-	core_mp_test_free();
+		g_replay_len -= res;
+		memmove(g_replay_buf, g_replay_buf + res, g_replay_len);
+		cond_resched();
+	}
 
-	core_config_ice_mode_enable();
+out:
+	mutex_unlock(&ilitek_replay_mutex);
+	return ret;
+}
 
-	if (core_config_set_watch_dog(false) < 0) {
-		ipio_err("Failed to disable watch dog\n");
-	}
+static int ilitek_proc_replay_release(struct inode *inode, struct file *filp)
+{
+	if (!(filp->f_mode & FMODE_WRITE))
+		return 0;
 
-	core_config_ic_reset();
+	mutex_lock(&ilitek_replay_mutex);
 
-	core_fr_mode_control(&protocol->demo_mode);
+	core_fr_replay_stop(&g_replay_stat);
+	if (g_replay_len > 0) {
+		ipio_err("The trace ends in the middle of a packet, %d bytes left\n", g_replay_len);
+		g_replay_stat.errors++;
+	}
 
-	ilitek_platform_enable_irq();
+	ipio_kfree((void **)&g_replay_buf);
+	g_replay_len = 0;
 
-	ipio_info("MP Test DONE\n");
-	ipio_kfree((void **)&va);
-	return size;
+	mutex_unlock(&ilitek_replay_mutex);
+	return 0;
 }
 
-static ssize_t ilitek_proc_debug_level_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+static ssize_t ilitek_proc_replay_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
 {
 	int res = 0;
 	uint32_t len = 0;
+	uint64_t ns = 0, rate = 0;
+	uint32_t err_mean = 0;
+	char str[256] = { 0 };
 
 	if (*pPos != 0)
 		return 0;
 
-	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
+	mutex_lock(&ilitek_replay_mutex);
 
-	len = sprintf(g_user_buf, "%d", ipio_debug_level);
+	if (g_replay_stat.packets > 0) {
+		ns = div_u64(g_replay_stat.elapsed_ns, g_replay_stat.packets);
+		if (g_replay_stat.elapsed_ns > 0)
+			rate = div64_u64((uint64_t)g_replay_stat.packets * NSEC_PER_SEC, g_replay_stat.elapsed_ns);
+	}
 
-	ipio_info("Current DEBUG Level = %d\n", ipio_debug_level);
-	ipio_info("You can set one of levels for debug as below:\n");
-	ipio_info("DEBUG_NONE = %d\n", DEBUG_NONE);
-	ipio_info("DEBUG_IRQ = %d\n", DEBUG_IRQ);
-	ipio_info("DEBUG_FINGER_REPORT = %d\n", DEBUG_FINGER_REPORT);
-	ipio_info("DEBUG_FIRMWARE = %d\n", DEBUG_FIRMWARE);
-	ipio_info("DEBUG_CONFIG = %d\n", DEBUG_CONFIG);
-	ipio_info("DEBUG_I2C = %d\n", DEBUG_I2C);
-	ipio_info("DEBUG_BATTERY = %d\n", DEBUG_BATTERY);
-	ipio_info("DEBUG_MP_TEST = %d\n", DEBUG_MP_TEST);
-	ipio_info("DEBUG_IOCTL = %d\n", DEBUG_IOCTL);
-	ipio_info("DEBUG_NETLINK = %d\n", DEBUG_NETLINK);
-	ipio_info("DEBUG_ALL = %d\n", DEBUG_ALL);
+	if (g_replay_stat.predict.samples > 0)
+		err_mean = (uint32_t)div_u64(g_replay_stat.predict.err_sum, g_replay_stat.predict.samples);
 
-	res = copy_to_user((uint32_t *) buff, &ipio_debug_level, len);
+	len = snprintf(str, sizeof(str),
+		"packets = %d\nerrors = %d\nns/packet = %llu\npackets/s = %llu\n"
+		"press = %d\nrelease = %d\nmove = %d\nsync = %d\n"
+		"predict samples = %d\npredict mean error = %d\npredict max error = %d\n",
+		g_replay_stat.packets, g_replay_stat.errors,
+		(unsigned long long)ns, (unsigned long long)rate,
+		g_replay_stat.events.press, g_replay_stat.events.release,
+		g_replay_stat.events.move, g_replay_stat.events.sync,
+		g_replay_stat.predict.samples, err_mean, g_replay_stat.predict.err_max);
+
+	mutex_unlock(&ilitek_replay_mutex);
+
+	len = min_t(uint32_t, len, size);
+	res = copy_to_user(buff, str, len);
 	if (res < 0) {
 		ipio_err("Failed to copy data to user space\n");
 	}
@@ -733,42 +1503,61 @@ static ssize_t ilitek_proc_debug_level_read(struct file *filp, char __user *buff
 
 	return len;
 }
+#endif /* FR_REPLAY */
 
-static ssize_t ilitek_proc_debug_level_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+/* The seq of the last frame read through this file is kept in private_data */
+static int ilitek_proc_heatmap_open(struct inode *inode, struct file *filp)
 {
-	int res = 0;
-	char cmd[10] = { 0 };
+	filp->private_data = NULL;
+	return core_heatmap_open();
+}
 
-	if (buff != NULL) {
-		res = copy_from_user(cmd, buff, size - 1);
-		if (res < 0) {
-			ipio_info("copy data from user space, failed\n");
-			return -1;
-		}
-	}
+static int ilitek_proc_heatmap_release(struct inode *inode, struct file *filp)
+{
+	core_heatmap_release();
+	return 0;
+}
 
-	ipio_debug_level = katoi(cmd);
+static ssize_t ilitek_proc_heatmap_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+{
+	ssize_t res = 0;
+	uint32_t seq = (uint32_t)(uintptr_t)filp->private_data;
 
-	ipio_info("ipio_debug_level = %d\n", ipio_debug_level);
+	res = core_heatmap_read(buff, size, &seq, filp->f_flags & O_NONBLOCK);
+	if (res > 0)
+		filp->private_data = (void *)(uintptr_t)seq;
 
-	return size;
+	return res;
 }
 
-static ssize_t ilitek_proc_gesture_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+#ifdef CHECKSUM_BENCH
+#define CHECKSUM_BENCH_LOOPS	10000
+
+static ssize_t ilitek_proc_checksum_bench_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
 {
-	int res = 0;
+	int res = 0, mismatch = 0;
 	uint32_t len = 0;
+	uint64_t ref_ns = 0, fast_ns = 0;
 
 	if (*pPos != 0)
 		return 0;
 
 	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
 
-	len = sprintf(g_user_buf, "%d", core_config->isEnableGesture);
+	mismatch = core_fr_checksum_bench(CHECKSUM_BENCH_LOOPS, &ref_ns, &fast_ns);
+	if (mismatch < 0)
+		return mismatch;
 
-	ipio_info("isEnableGesture = %d\n", core_config->isEnableGesture);
+	/* mismatch bytewise(ns/packet) fast(ns/packet) */
+	len = sprintf(g_user_buf, "%d %llu %llu\n", mismatch,
+		(unsigned long long)div_u64(ref_ns, CHECKSUM_BENCH_LOOPS),
+		(unsigned long long)div_u64(fast_ns, CHECKSUM_BENCH_LOOPS));
 
-	res = copy_to_user((uint32_t *) buff, &core_config->isEnableGesture, len);
+	ipio_info("checksum bench: mismatch = %d, bytewise = %lluns, fast = %lluns\n", mismatch,
+		(unsigned long long)div_u64(ref_ns, CHECKSUM_BENCH_LOOPS),
+		(unsigned long long)div_u64(fast_ns, CHECKSUM_BENCH_LOOPS));
+
+	res = copy_to_user(buff, g_user_buf, len);
 	if (res < 0) {
 		ipio_err("Failed to copy data to user space\n");
 	}
@@ -777,41 +1566,9 @@ static ssize_t ilitek_proc_gesture_read(struct file *filp, char __user *buff, si
 
 	return len;
 }
+#endif /* CHECKSUM_BENCH */
 
-static ssize_t ilitek_proc_gesture_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
-{
-	int res = 0;
-	char cmd[10] = { 0 };
-
-	if (buff != NULL) {
-		res = copy_from_user(cmd, buff, size - 1);
-		if (res < 0) {
-			ipio_info("copy data from user space, failed\n");
-			return -1;
-		}
-	}
-
-	ipio_info("size = %d, cmd = %s\n", (int)size, cmd);
-
-	if (strcmp(cmd, "on") == 0) {
-		ipio_info("enable gesture mode\n");
-		core_config->isEnableGesture = true;
-	} else if (strcmp(cmd, "off") == 0) {
-		ipio_info("disable gesture mode\n");
-		core_config->isEnableGesture = false;
-	} else if (strcmp(cmd, "info") == 0) {
-		ipio_info("gesture info mode\n");
-		core_gesture->mode = GESTURE_INFO_MPDE;
-	} else if (strcmp(cmd, "normal") == 0) {
-		ipio_info("gesture normal mode\n");
-		core_gesture->mode = GESTURE_NORMAL_MODE;
-	} else
-		ipio_err("Unknown command\n");
-
-	return size;
-}
-
-static ssize_t ilitek_proc_check_battery_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+static ssize_t ilitek_proc_axis_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
 {
 	int res = 0;
 	uint32_t len = 0;
@@ -821,11 +1578,11 @@ static ssize_t ilitek_proc_check_battery_read(struct file *filp, char __user *bu
 
 	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
 
-	len = sprintf(g_user_buf, "%d", ipd->isEnablePollCheckPower);
-
-	ipio_info("isEnablePollCheckPower = %d\n", ipd->isEnablePollCheckPower);
+	/* swap_xy invert_x invert_y offset_x offset_y */
+	len = sprintf(g_user_buf, "%d %d %d %d %d\n", core_fr->isSwapXY,
+		core_fr->isInvertX, core_fr->isInvertY, core_fr->offset_x, core_fr->offset_y);
 
-	res = copy_to_user((uint32_t *) buff, &ipd->isEnablePollCheckPower, len);
+	res = copy_to_user(buff, g_user_buf, len);
 	if (res < 0) {
 		ipio_err("Failed to copy data to user space\n");
 	}
@@ -835,21 +1592,17 @@ static ssize_t ilitek_proc_check_battery_read(struct file *filp, char __user *bu
 	return len;
 }
 
-static ssize_t ilitek_proc_check_battery_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+static ssize_t ilitek_proc_axis_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
 {
 	int res = 0;
-	char cmd[10] = { 0 };
+	int swap = 0, invert_x = 0, invert_y = 0, offset_x = 0, offset_y = 0;
+	char cmd[64] = { 0 };
 
 	if (size > sizeof(cmd)) {
 		ipio_err("Size is larger than the length of cmd\n");
 		goto out;
 	}
 
-	if (ipd->check_power_status_queue == NULL) {
-		ipio_err("work queue isn't created, do nothing\n");
-		goto out;
-	}
-
 	if (buff != NULL) {
 		res = copy_from_user(cmd, buff, size - 1);
 		if (res < 0) {
@@ -858,24 +1611,24 @@ static ssize_t ilitek_proc_check_battery_write(struct file *filp, const char *bu
 		}
 	}
 
-	ipio_info("size = %d, cmd = %s\n", (int)size, cmd);
+	if (sscanf(cmd, "%d %d %d %d %d", &swap, &invert_x, &invert_y, &offset_x, &offset_y) != 5) {
+		ipio_err("Usage: echo <swap_xy> <invert_x> <invert_y> <offset_x> <offset_y>\n");
+		goto out;
+	}
 
-	if (strcmp(cmd, "on") == 0) {
-		ipio_info("Start the thread of check power status\n");
-		queue_delayed_work(ipd->check_power_status_queue, &ipd->check_power_status_work, ipd->work_delay);
-		ipd->isEnablePollCheckPower = true;
-	} else if (strcmp(cmd, "off") == 0) {
-		ipio_info("Cancel the thread of check power status\n");
-		cancel_delayed_work_sync(&ipd->check_power_status_work);
-		ipd->isEnablePollCheckPower = false;
-	} else
-		ipio_err("Unknown command\n");
+	core_fr->isSwapXY = !!swap;
+	core_fr->isInvertX = !!invert_x;
+	core_fr->isInvertY = !!invert_y;
+	core_fr->offset_x = offset_x;
+	core_fr->offset_y = offset_y;
+
+	core_fr_update_transform();
 
 out:
 	return size;
 }
 
-static ssize_t ilitek_proc_check_esd_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
+static ssize_t ilitek_proc_irq_thread_prio_read(struct file *filp, char __user *buff, size_t size, loff_t *pPos)
 {
 	int res = 0;
 	uint32_t len = 0;
@@ -885,11 +1638,11 @@ static ssize_t ilitek_proc_check_esd_read(struct file *filp, char __user *buff,
 
 	memset(g_user_buf, 0, USER_STR_BUFF * sizeof(unsigned char));
 
-	len = sprintf(g_user_buf, "%d", ipd->isEnablePollCheckEsd);
+	len = sprintf(g_user_buf, "%d\n", ipd->irq_thread_prio);
 
-	ipio_info("isEnablePollCheckEsd = %d\n", ipd->isEnablePollCheckEsd);
+	ipio_info("irq_thread_prio = %d\n", ipd->irq_thread_prio);
 
-	res = copy_to_user((uint32_t *) buff, &ipd->isEnablePollCheckEsd, len);
+	res = copy_to_user(buff, g_user_buf, len);
 	if (res < 0) {
 		ipio_err("Failed to copy data to user space\n");
 	}
@@ -899,21 +1652,19 @@ static ssize_t ilitek_proc_check_esd_read(struct file *filp, char __user *buff,
 	return len;
 }
 
-static ssize_t ilitek_proc_check_esd_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
+static ssize_t ilitek_proc_irq_thread_prio_write(struct file *filp, const char *buff, size_t size, loff_t *pPos)
 {
 	int res = 0;
 	char cmd[10] = { 0 };
+#if defined (USE_KTHREAD) || defined (USE_IRQ_THREAD)
+	int prio = 0;
+#endif
 
 	if (size > sizeof(cmd)) {
 		ipio_err("Size is larger than the length of cmd\n");
 		goto out;
 	}
 
-	if (ipd->check_esd_status_queue == NULL) {
-		ipio_err("work queue isn't created, do nothing\n");
-		goto out;
-	}
-
 	if (buff != NULL) {
 		res = copy_from_user(cmd, buff, size - 1);
 		if (res < 0) {
@@ -922,19 +1673,19 @@ static ssize_t ilitek_proc_check_esd_write(struct file *filp, const char *buff,
 		}
 	}
 
-	ipio_info("size = %d, cmd = %s\n", (int)size, cmd);
+#if defined (USE_KTHREAD) || defined (USE_IRQ_THREAD)
+	prio = katoi(cmd);
+	if (prio <= 0 || prio >= MAX_USER_RT_PRIO) {
+		ipio_err("Invalid priority (%d), should be 1 - %d\n", prio, MAX_USER_RT_PRIO - 1);
+		goto out;
+	}
 
-	if (strcmp(cmd, "on") == 0) {
-		ipio_info("Start the thread of check esd status\n");
-		queue_delayed_work(ipd->check_esd_status_queue,
-			&ipd->check_esd_status_work, ipd->esd_check_time);
-		ipd->isEnablePollCheckEsd = true;
-	} else if (strcmp(cmd, "off") == 0) {
-		ipio_info("Cancel the thread of check esd status\n");
-		cancel_delayed_work_sync(&ipd->check_esd_status_work);
-		ipd->isEnablePollCheckEsd = false;
-	} else
-		ipio_err("Unknown command\n");
+	/* It's applied by the irq thread itself at the next interrupt */
+	ipd->irq_thread_prio = prio;
+	ipio_info("irq_thread_prio = %d\n", ipd->irq_thread_prio);
+#else
+	ipio_err("Interrupt events are handled by work queue, priority isn't supported\n");
+#endif
 
 out:
 	return size;
@@ -1538,6 +2289,54 @@ struct file_operations proc_check_esd_fops = {
 	.read = ilitek_proc_check_esd_read,
 };
 
+struct file_operations proc_axis_fops = {
+	.write = ilitek_proc_axis_write,
+	.read = ilitek_proc_axis_read,
+};
+
+struct file_operations proc_coalesce_fops = {
+	.write = ilitek_proc_coalesce_write,
+	.read = ilitek_proc_coalesce_read,
+};
+
+struct file_operations proc_predict_fops = {
+	.write = ilitek_proc_predict_write,
+	.read = ilitek_proc_predict_read,
+};
+
+#ifdef BUS_EMULATOR
+struct file_operations proc_emu_fops = {
+	.write = ilitek_proc_emu_write,
+	.read = ilitek_proc_emu_read,
+};
+#endif /* BUS_EMULATOR */
+
+#ifdef FR_REPLAY
+struct file_operations proc_replay_fops = {
+	.open = ilitek_proc_replay_open,
+	.release = ilitek_proc_replay_release,
+	.write = ilitek_proc_replay_write,
+	.read = ilitek_proc_replay_read,
+};
+#endif /* FR_REPLAY */
+
+struct file_operations proc_heatmap_fops = {
+	.open = ilitek_proc_heatmap_open,
+	.release = ilitek_proc_heatmap_release,
+	.read = ilitek_proc_heatmap_read,
+};
+
+#ifdef CHECKSUM_BENCH
+struct file_operations proc_checksum_bench_fops = {
+	.read = ilitek_proc_checksum_bench_read,
+};
+#endif /* CHECKSUM_BENCH */
+
+struct file_operations proc_irq_thread_prio_fops = {
+	.write = ilitek_proc_irq_thread_prio_write,
+	.read = ilitek_proc_irq_thread_prio_read,
+};
+
 struct file_operations proc_debug_level_fops = {
 	.write = ilitek_proc_debug_level_write,
 	.read = ilitek_proc_debug_level_read,
@@ -1557,11 +2356,14 @@ struct file_operations proc_oppo_mp_lcm_off_fops = {
 };
 
 struct file_operations proc_debug_message_fops = {
+	.open = ilitek_proc_debug_message_open,
+	.release = ilitek_proc_debug_message_release,
 	.write = ilitek_proc_debug_message_write,
 	.read = ilitek_proc_debug_message_read,
 };
 
 struct file_operations proc_debug_message_switch_fops = {
+	.write = ilitek_proc_debug_switch_write,
 	.read = ilitek_proc_debug_switch_read,
 };
 /* huaqin add for ZQL1830-127 by liufurong at 20180731 start */
@@ -1584,6 +2386,8 @@ typedef struct {
 	struct proc_dir_entry *node;
 	struct file_operations *fops;
 	bool isCreated;
+	/* 0666 if it's not given */
+	umode_t mode;
 } proc_node_t;
 
 proc_node_t proc_table[] = {
@@ -1594,6 +2398,21 @@ proc_node_t proc_table[] = {
 	{"gesture", NULL, &proc_gesture_fops, false},
 	{"check_battery", NULL, &proc_check_battery_fops, false},
 	{"check_esd", NULL, &proc_check_esd_fops, false},
+	{"irq_thread_prio", NULL, &proc_irq_thread_prio_fops, false},
+	{"axis", NULL, &proc_axis_fops, false},
+#ifdef CHECKSUM_BENCH
+	{"checksum_bench", NULL, &proc_checksum_bench_fops, false},
+#endif /* CHECKSUM_BENCH */
+	{"heatmap", NULL, &proc_heatmap_fops, false},
+#ifdef FR_REPLAY
+	/* it stops touch for a while, so only root can run it */
+	{"replay", NULL, &proc_replay_fops, false, 0600},
+#endif /* FR_REPLAY */
+	{"coalesce", NULL, &proc_coalesce_fops, false},
+	{"predict", NULL, &proc_predict_fops, false},
+#ifdef BUS_EMULATOR
+	{"emu", NULL, &proc_emu_fops, false},
+#endif /* BUS_EMULATOR */
 	{"debug_level", NULL, &proc_debug_level_fops, false},
 	{"mp_test", NULL, &proc_mp_test_fops, false},
 	{"oppo_mp_lcm_on", NULL, &proc_oppo_mp_lcm_on_fops, false},
@@ -1606,39 +2425,209 @@ proc_node_t proc_table[] = {
 };
 
 #define NETLINK_USER 21
+
+/*
+ * Frames are sent in batches as one multipart message, each frame is carried
+ * by a NETLINK_ILITEK_FRAME message with NLM_F_MULTI and the batch ends with
+ * an empty NLMSG_DONE. A batch is flushed once it would be over
+ * NETLINK_BATCH_SIZE bytes, holds NETLINK_BATCH_FRAMES frames, or the first
+ * frame in it has waited NETLINK_FLUSH_MS.
+ *
+ * It goes to the pid registered by the last request, and to anyone joining
+ * NETLINK_GROUP_FRAME without having to send anything to the driver.
+ */
+#define NETLINK_ILITEK_FRAME	(NLMSG_MIN_TYPE + 1)
+#define NETLINK_GROUP_FRAME	1
+#define NETLINK_GROUP_NUM	1
+#define NETLINK_BATCH_SIZE	(16 * 1024)
+#define NETLINK_BATCH_FRAMES	8
+#define NETLINK_FLUSH_MS	8
+#define NETLINK_SKB_POOL	4
+
+struct netlink_batch {
+	spinlock_t lock;
+	struct sk_buff *skb;
+	int frames;
+	uint32_t seq;
+	uint32_t dropped;
+
+	/* skbs allocated ahead by refill work, the irq path never allocates */
+	struct sk_buff *spare[NETLINK_SKB_POOL];
+	int spare_num;
+
+	struct work_struct refill;
+	struct delayed_work flush;
+};
+
 struct sock *_gNetLinkSkb;
 struct nlmsghdr *_gNetLinkHead;
-struct sk_buff *_gSkbOut;
 int _gPID;
+static struct netlink_batch g_nl_batch;
 
-void netlink_reply_msg(void *raw, int size)
+static void netlink_refill(struct work_struct *work)
+{
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	while (1) {
+		skb = nlmsg_new(NETLINK_BATCH_SIZE, GFP_KERNEL);
+		if (!skb) {
+			ipio_err("Failed to allocate new skb\n");
+			return;
+		}
+
+		spin_lock_irqsave(&g_nl_batch.lock, flags);
+		if (g_nl_batch.spare_num >= NETLINK_SKB_POOL) {
+			spin_unlock_irqrestore(&g_nl_batch.lock, flags);
+			kfree_skb(skb);
+			return;
+		}
+		g_nl_batch.spare[g_nl_batch.spare_num++] = skb;
+		spin_unlock_irqrestore(&g_nl_batch.lock, flags);
+	}
+}
+
+static bool netlink_has_receiver(void)
+{
+	if (_gNetLinkSkb == NULL)
+		return false;
+
+	return (core_fr->isEnableNetlink && _gPID != 0) ||
+		netlink_has_listeners(_gNetLinkSkb, NETLINK_GROUP_FRAME);
+}
+
+/* Must be called with the lock held, returns the batch to be sent */
+static struct sk_buff *netlink_batch_detach(void)
+{
+	struct sk_buff *skb = g_nl_batch.skb;
+
+	if (skb == NULL)
+		return NULL;
+
+	if (nlmsg_put(skb, 0, g_nl_batch.seq, NLMSG_DONE, 0, NLM_F_MULTI) == NULL) {
+		/* room for it was kept when the frames were added */
+		ipio_err("No room for the end of batch\n");
+	}
+
+	g_nl_batch.skb = NULL;
+	g_nl_batch.frames = 0;
+	g_nl_batch.seq++;
+	return skb;
+}
+
+static void netlink_batch_send(struct sk_buff *skb)
 {
 	int res;
-	int msg_size = size;
-	uint8_t *data = (uint8_t *) raw;
+	bool group;
+	struct sk_buff *uskb = NULL;
 
-	ipio_debug(DEBUG_NETLINK, "The size of data being sent to user = %d\n", msg_size);
-	ipio_debug(DEBUG_NETLINK, "pid = %d\n", _gPID);
-	ipio_debug(DEBUG_NETLINK, "Netlink is enable = %d\n", core_fr->isEnableNetlink);
+	if (skb == NULL)
+		return;
 
-	if (core_fr->isEnableNetlink) {
-		_gSkbOut = nlmsg_new(msg_size, 0);
+	ipio_debug(DEBUG_NETLINK, "Send a batch of %d bytes, pid = %d\n", skb->len, _gPID);
 
-		if (!_gSkbOut) {
-			ipio_err("Failed to allocate new skb\n");
+	group = netlink_has_listeners(_gNetLinkSkb, NETLINK_GROUP_FRAME);
+
+	if (core_fr->isEnableNetlink && _gPID != 0) {
+		/* unicast queues the skb at the receiver, so the group needs a clone */
+		uskb = group ? skb_clone(skb, GFP_KERNEL) : skb;
+		if (uskb == NULL) {
+			ipio_err("Failed to clone the batch for pid %d\n", _gPID);
+		} else {
+			res = nlmsg_unicast(_gNetLinkSkb, uskb, _gPID);
+			if (res < 0)
+				ipio_err("Failed to send data back to user\n");
+		}
+
+		if (!group)
+			return;
+	}
+
+	if (group) {
+		NETLINK_CB(skb).dst_group = NETLINK_GROUP_FRAME;
+		res = nlmsg_multicast(_gNetLinkSkb, skb, 0, NETLINK_GROUP_FRAME, GFP_KERNEL);
+		if (res < 0 && res != -ESRCH)
+			ipio_err("Failed to multicast data to user, res = %d\n", res);
+	} else {
+		kfree_skb(skb);
+	}
+}
+
+static void netlink_flush(struct work_struct *work)
+{
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&g_nl_batch.lock, flags);
+	skb = netlink_batch_detach();
+	spin_unlock_irqrestore(&g_nl_batch.lock, flags);
+
+	netlink_batch_send(skb);
+}
+
+void netlink_reply_msg(void *raw, int size)
+{
+	struct sk_buff *skb, *full = NULL;
+	struct nlmsghdr *nlh;
+	unsigned long flags;
+	int need = nlmsg_total_size(size) + nlmsg_total_size(0);
+	bool refill = false, arm = false;
+
+	if (!netlink_has_receiver())
+		return;
+
+	if (need > NETLINK_BATCH_SIZE) {
+		ipio_err("The size of data (%d) is too large to send\n", size);
+		return;
+	}
+
+	spin_lock_irqsave(&g_nl_batch.lock, flags);
+
+	skb = g_nl_batch.skb;
+	if (skb != NULL && skb_tailroom(skb) < need) {
+		full = netlink_batch_detach();
+		skb = NULL;
+	}
+
+	if (skb == NULL) {
+		if (g_nl_batch.spare_num == 0) {
+			g_nl_batch.dropped++;
+			spin_unlock_irqrestore(&g_nl_batch.lock, flags);
+			ipio_debug(DEBUG_NETLINK, "No skb left, dropped %d\n", g_nl_batch.dropped);
+			schedule_work(&g_nl_batch.refill);
+			if (full != NULL)
+				cancel_delayed_work(&g_nl_batch.flush);
+			netlink_batch_send(full);
 			return;
 		}
 
-		_gNetLinkHead = nlmsg_put(_gSkbOut, 0, 0, NLMSG_DONE, msg_size, 0);
-		NETLINK_CB(_gSkbOut).dst_group = 0;	/* not in mcast group */
+		skb = g_nl_batch.spare[--g_nl_batch.spare_num];
+		g_nl_batch.skb = skb;
+		refill = true;
+		arm = true;
+	}
 
-		/* strncpy(NLMSG_DATA(_gNetLinkHead), data, msg_size); */
-		memcpy(nlmsg_data(_gNetLinkHead), data, msg_size);
+	nlh = nlmsg_put(skb, 0, g_nl_batch.seq, NETLINK_ILITEK_FRAME, size, NLM_F_MULTI);
+	memcpy(nlmsg_data(nlh), raw, size);
+	g_nl_batch.frames++;
 
-		res = nlmsg_unicast(_gNetLinkSkb, _gSkbOut, _gPID);
-		if (res < 0)
-			ipio_err("Failed to send data back to user\n");
+	if (full == NULL && g_nl_batch.frames >= NETLINK_BATCH_FRAMES) {
+		full = netlink_batch_detach();
+		arm = false;
 	}
+
+	spin_unlock_irqrestore(&g_nl_batch.lock, flags);
+
+	if (refill)
+		schedule_work(&g_nl_batch.refill);
+
+	/* a batch sent early takes its deadline away, a fresh one gets its own */
+	if (arm)
+		mod_delayed_work(system_wq, &g_nl_batch.flush, msecs_to_jiffies(NETLINK_FLUSH_MS));
+	else if (full != NULL)
+		cancel_delayed_work(&g_nl_batch.flush);
+
+	netlink_batch_send(full);
 }
 EXPORT_SYMBOL(netlink_reply_msg);
 
@@ -1673,9 +2662,11 @@ static int netlink_init(void)
 	int res = 0;
 
 #if KERNEL_VERSION(3, 4, 0) > LINUX_VERSION_CODE
-	_gNetLinkSkb = netlink_kernel_create(&init_net, NETLINK_USER, netlink_recv_msg, NULL, THIS_MODULE);
+	_gNetLinkSkb = netlink_kernel_create(&init_net, NETLINK_USER, NETLINK_GROUP_NUM,
+			netlink_recv_msg, NULL, THIS_MODULE);
 #else
 	struct netlink_kernel_cfg cfg = {
+		.groups = NETLINK_GROUP_NUM,
 		.input = netlink_recv_msg,
 	};
 
@@ -1687,11 +2678,34 @@ static int netlink_init(void)
 	if (!_gNetLinkSkb) {
 		ipio_err("Failed to create nelink socket\n");
 		res = -EFAULT;
+		return res;
 	}
 
+	spin_lock_init(&g_nl_batch.lock);
+	INIT_WORK(&g_nl_batch.refill, netlink_refill);
+	INIT_DELAYED_WORK(&g_nl_batch.flush, netlink_flush);
+	netlink_refill(&g_nl_batch.refill);
+
 	return res;
 }
 
+static void netlink_remove(void)
+{
+	if (!_gNetLinkSkb)
+		return;
+
+	cancel_delayed_work_sync(&g_nl_batch.flush);
+	cancel_work_sync(&g_nl_batch.refill);
+
+	kfree_skb(g_nl_batch.skb);
+	g_nl_batch.skb = NULL;
+	while (g_nl_batch.spare_num > 0)
+		kfree_skb(g_nl_batch.spare[--g_nl_batch.spare_num]);
+
+	netlink_kernel_release(_gNetLinkSkb);
+	_gNetLinkSkb = NULL;
+}
+
 int ilitek_proc_init(void)
 {
 	int i = 0, res = 0;
@@ -1699,7 +2713,8 @@ int ilitek_proc_init(void)
 	proc_dir_ilitek = proc_mkdir("ilitek", NULL);
 
 	for (; i < ARRAY_SIZE(proc_table); i++) {
-		proc_table[i].node = proc_create(proc_table[i].name, 0666, proc_dir_ilitek, proc_table[i].fops);
+		proc_table[i].node = proc_create(proc_table[i].name, proc_table[i].mode ? proc_table[i].mode : 0666,
+						proc_dir_ilitek, proc_table[i].fops);
 
 		if (proc_table[i].node == NULL) {
 			proc_table[i].isCreated = false;
@@ -1729,6 +2744,6 @@ void ilitek_proc_remove(void)
 	}
 
 	remove_proc_entry("ilitek", NULL);
-	netlink_kernel_release(_gNetLinkSkb);
+	netlink_remove();
 }
 EXPORT_SYMBOL(ilitek_proc_remove);
@@ -0,0 +1,373 @@
+/*
+ * ILITEK Touch IC driver
+ *
+ * Copyright (C) 2011 ILI Technology Corporation.
+ *
+ * Author: Dicky Chiang <dicky_chiang@ilitek.com>
+ * Based on TDD v7.0 implemented by Mstar & ILITEK
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "common.h"
+#include "platform.h"
+#include "core/config.h"
+#include "core/finger_report.h"
+#include "core/heatmap.h"
+#include "core/protocol.h"
+
+#ifdef TOUCH_V4L2
+
+#include <media/v4l2-device.h>
+#include <media/v4l2-ioctl.h>
+#include <media/videobuf2-v4l2.h>
+#include <media/videobuf2-vmalloc.h>
+
+/*
+ * A V4L2 touch device capturing mutual data of debug mode as
+ * V4L2_TCH_FMT_DELTA_TD16, width by x channels and height by y channels.
+ *
+ * Buffers queued by users wait on a list, and the irq path decodes each
+ * debug packet straight into the first of them, so a frame is written once
+ * and then mapped or exported by users with no other copies.
+ */
+struct ilitek_v4l2_buffer {
+	struct vb2_v4l2_buffer vb;
+	struct list_head list;
+};
+
+struct ilitek_v4l2_data {
+	struct v4l2_device v4l2;
+	struct video_device vdev;
+	struct vb2_queue queue;
+	/* serialises ioctls and the queue */
+	struct mutex lock;
+	/* guards buffers between the irq path and the queue */
+	spinlock_t slock;
+	/* held while a buffer taken off the list is filled, until it's done */
+	struct mutex push_lock;
+	struct list_head buffers;
+	uint32_t sequence;
+	bool registered;
+};
+
+static struct ilitek_v4l2_data *ilitek_v4l2 = NULL;
+
+static void v4l2_get_size(uint16_t *width, uint16_t *height)
+{
+	*width = 0;
+	*height = 0;
+
+	if (!ERR_ALLOC_MEM(core_config->tp_info)) {
+		*width = core_config->tp_info->nXChannelNum;
+		*height = core_config->tp_info->nYChannelNum;
+	}
+}
+
+static void v4l2_fill_fmt(struct v4l2_pix_format *pix)
+{
+	uint16_t width, height;
+
+	v4l2_get_size(&width, &height);
+
+	pix->pixelformat = V4L2_TCH_FMT_DELTA_TD16;
+	pix->width = width;
+	pix->height = height;
+	pix->field = V4L2_FIELD_NONE;
+	pix->colorspace = V4L2_COLORSPACE_RAW;
+	pix->bytesperline = width * sizeof(int16_t);
+	pix->sizeimage = width * height * sizeof(int16_t);
+}
+
+void ilitek_v4l2_push(uint8_t *data, uint16_t len)
+{
+	uint16_t width, height;
+	unsigned long flags;
+	int16_t *dst = NULL;
+	struct ilitek_v4l2_buffer *buf = NULL;
+	enum vb2_buffer_state state = VB2_BUF_STATE_DONE;
+
+	if (ilitek_v4l2 == NULL || !vb2_is_streaming(&ilitek_v4l2->queue))
+		return;
+
+	mutex_lock(&ilitek_v4l2->push_lock);
+
+	spin_lock_irqsave(&ilitek_v4l2->slock, flags);
+	buf = list_first_entry_or_null(&ilitek_v4l2->buffers, struct ilitek_v4l2_buffer, list);
+	if (buf != NULL)
+		list_del(&buf->list);
+	spin_unlock_irqrestore(&ilitek_v4l2->slock, flags);
+
+	if (buf == NULL) {
+		ipio_debug(DEBUG_FINGER_REPORT, "No v4l2 buffer queued, drop a frame\n");
+		mutex_unlock(&ilitek_v4l2->push_lock);
+		return;
+	}
+
+	v4l2_get_size(&width, &height);
+	dst = vb2_plane_vaddr(&buf->vb.vb2_buf, 0);
+
+	if (dst == NULL || HEATMAP_DATA_OFFSET + width * height * sizeof(int16_t) > len ||
+		width * height * sizeof(int16_t) > vb2_plane_size(&buf->vb.vb2_buf, 0)) {
+		ipio_err("Wrong size of v4l2 frame, x = %d, y = %d, len = %d\n", width, height, len);
+		state = VB2_BUF_STATE_ERROR;
+		goto out;
+	}
+
+	core_heatmap_decode_be16(dst, data + HEATMAP_DATA_OFFSET, width * height);
+	vb2_set_plane_payload(&buf->vb.vb2_buf, 0, width * height * sizeof(int16_t));
+
+out:
+	buf->vb.field = V4L2_FIELD_NONE;
+	buf->vb.sequence = ilitek_v4l2->sequence++;
+	buf->vb.vb2_buf.timestamp = ktime_get_ns();
+	vb2_buffer_done(&buf->vb.vb2_buf, state);
+
+	mutex_unlock(&ilitek_v4l2->push_lock);
+}
+EXPORT_SYMBOL(ilitek_v4l2_push);
+
+static int v4l2_queue_setup(struct vb2_queue *q, unsigned int *nbuffers, unsigned int *nplanes,
+	unsigned int sizes[], struct device *alloc_devs[])
+{
+	struct v4l2_pix_format pix;
+
+	v4l2_fill_fmt(&pix);
+	if (pix.sizeimage == 0)
+		return -EINVAL;
+
+	if (*nplanes)
+		return sizes[0] < pix.sizeimage ? -EINVAL : 0;
+
+	*nplanes = 1;
+	sizes[0] = pix.sizeimage;
+	return 0;
+}
+
+static void v4l2_buf_queue(struct vb2_buffer *vb)
+{
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(vb);
+	struct ilitek_v4l2_buffer *buf = container_of(vbuf, struct ilitek_v4l2_buffer, vb);
+	unsigned long flags;
+
+	spin_lock_irqsave(&ilitek_v4l2->slock, flags);
+	list_add_tail(&buf->list, &ilitek_v4l2->buffers);
+	spin_unlock_irqrestore(&ilitek_v4l2->slock, flags);
+}
+
+static void v4l2_return_buffers(enum vb2_buffer_state state)
+{
+	struct ilitek_v4l2_buffer *buf, *tmp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ilitek_v4l2->slock, flags);
+	list_for_each_entry_safe(buf, tmp, &ilitek_v4l2->buffers, list) {
+		list_del(&buf->list);
+		vb2_buffer_done(&buf->vb.vb2_buf, state);
+	}
+	spin_unlock_irqrestore(&ilitek_v4l2->slock, flags);
+}
+
+static int v4l2_start_streaming(struct vb2_queue *q, unsigned int count)
+{
+	ilitek_v4l2->sequence = 0;
+
+	if (core_fr->actual_fw_mode != protocol->debug_mode)
+		ipio_info("Firmware isn't at debug mode, no frames until it's switched\n");
+
+	return 0;
+}
+
+static void v4l2_stop_streaming(struct vb2_queue *q)
+{
+	/* wait for a buffer being filled, vb2 takes all of them back after this */
+	mutex_lock(&ilitek_v4l2->push_lock);
+	v4l2_return_buffers(VB2_BUF_STATE_ERROR);
+	mutex_unlock(&ilitek_v4l2->push_lock);
+}
+
+static const struct vb2_ops ilitek_v4l2_queue_ops = {
+	.queue_setup = v4l2_queue_setup,
+	.buf_queue = v4l2_buf_queue,
+	.start_streaming = v4l2_start_streaming,
+	.stop_streaming = v4l2_stop_streaming,
+	.wait_prepare = vb2_ops_wait_prepare,
+	.wait_finish = vb2_ops_wait_finish,
+};
+
+static int v4l2_querycap(struct file *file, void *priv, struct v4l2_capability *cap)
+{
+	strlcpy(cap->driver, "ILITEK_TDDI", sizeof(cap->driver));
+	strlcpy(cap->card, "ILITEK touch mutual data", sizeof(cap->card));
+	snprintf(cap->bus_info, sizeof(cap->bus_info), "%s", dev_name(ipd->dev));
+	return 0;
+}
+
+static int v4l2_enum_input(struct file *file, void *priv, struct v4l2_input *i)
+{
+	if (i->index != 0)
+		return -EINVAL;
+
+	i->type = V4L2_INPUT_TYPE_TOUCH;
+	strlcpy(i->name, "Mutual Capacitance Deltas", sizeof(i->name));
+	return 0;
+}
+
+static int v4l2_g_input(struct file *file, void *priv, unsigned int *i)
+{
+	*i = 0;
+	return 0;
+}
+
+static int v4l2_s_input(struct file *file, void *priv, unsigned int i)
+{
+	return i == 0 ? 0 : -EINVAL;
+}
+
+static int v4l2_enum_fmt(struct file *file, void *priv, struct v4l2_fmtdesc *fmt)
+{
+	if (fmt->index != 0)
+		return -EINVAL;
+
+	fmt->pixelformat = V4L2_TCH_FMT_DELTA_TD16;
+	return 0;
+}
+
+/* The format only depends on tp info, so get, set and try all return it */
+static int v4l2_fmt(struct file *file, void *priv, struct v4l2_format *f)
+{
+	v4l2_fill_fmt(&f->fmt.pix);
+	return 0;
+}
+
+static const struct v4l2_ioctl_ops ilitek_v4l2_ioctl_ops = {
+	.vidioc_querycap = v4l2_querycap,
+
+	.vidioc_enum_input = v4l2_enum_input,
+	.vidioc_g_input = v4l2_g_input,
+	.vidioc_s_input = v4l2_s_input,
+
+	.vidioc_enum_fmt_vid_cap = v4l2_enum_fmt,
+	.vidioc_g_fmt_vid_cap = v4l2_fmt,
+	.vidioc_s_fmt_vid_cap = v4l2_fmt,
+	.vidioc_try_fmt_vid_cap = v4l2_fmt,
+
+	.vidioc_reqbufs = vb2_ioctl_reqbufs,
+	.vidioc_create_bufs = vb2_ioctl_create_bufs,
+	.vidioc_querybuf = vb2_ioctl_querybuf,
+	.vidioc_qbuf = vb2_ioctl_qbuf,
+	.vidioc_dqbuf = vb2_ioctl_dqbuf,
+	.vidioc_expbuf = vb2_ioctl_expbuf,
+	.vidioc_streamon = vb2_ioctl_streamon,
+	.vidioc_streamoff = vb2_ioctl_streamoff,
+};
+
+static const struct v4l2_file_operations ilitek_v4l2_fops = {
+	.owner = THIS_MODULE,
+	.open = v4l2_fh_open,
+	.release = vb2_fop_release,
+	.unlocked_ioctl = video_ioctl2,
+	.read = vb2_fop_read,
+	.mmap = vb2_fop_mmap,
+	.poll = vb2_fop_poll,
+};
+
+int ilitek_v4l2_init(void)
+{
+	int res = 0;
+	struct vb2_queue *q = NULL;
+	struct video_device *vdev = NULL;
+
+	ilitek_v4l2 = devm_kzalloc(ipd->dev, sizeof(*ilitek_v4l2), GFP_KERNEL);
+	if (ERR_ALLOC_MEM(ilitek_v4l2)) {
+		ipio_err("Failed to allocate ilitek_v4l2 mem, %ld\n", PTR_ERR(ilitek_v4l2));
+		ilitek_v4l2 = NULL;
+		return -ENOMEM;
+	}
+
+	mutex_init(&ilitek_v4l2->lock);
+	spin_lock_init(&ilitek_v4l2->slock);
+	mutex_init(&ilitek_v4l2->push_lock);
+	INIT_LIST_HEAD(&ilitek_v4l2->buffers);
+
+	res = v4l2_device_register(ipd->dev, &ilitek_v4l2->v4l2);
+	if (res < 0) {
+		ipio_err("Failed to register v4l2 device, res = %d\n", res);
+		goto out;
+	}
+
+	q = &ilitek_v4l2->queue;
+	q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	q->io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF | VB2_READ;
+	q->buf_struct_size = sizeof(struct ilitek_v4l2_buffer);
+	q->ops = &ilitek_v4l2_queue_ops;
+	q->mem_ops = &vb2_vmalloc_memops;
+	q->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	q->min_buffers_needed = 1;
+	q->lock = &ilitek_v4l2->lock;
+
+	res = vb2_queue_init(q);
+	if (res < 0) {
+		ipio_err("Failed to initialise vb2 queue, res = %d\n", res);
+		goto out_unregister;
+	}
+
+	vdev = &ilitek_v4l2->vdev;
+	strlcpy(vdev->name, "ilitek_touch", sizeof(vdev->name));
+	vdev->fops = &ilitek_v4l2_fops;
+	vdev->ioctl_ops = &ilitek_v4l2_ioctl_ops;
+	vdev->release = video_device_release_empty;
+	vdev->v4l2_dev = &ilitek_v4l2->v4l2;
+	vdev->lock = &ilitek_v4l2->lock;
+	vdev->queue = q;
+	vdev->vfl_dir = VFL_DIR_RX;
+	vdev->device_caps = V4L2_CAP_TOUCH | V4L2_CAP_VIDEO_CAPTURE |
+		V4L2_CAP_READWRITE | V4L2_CAP_STREAMING;
+
+	res = video_register_device(vdev, VFL_TYPE_TOUCH, -1);
+	if (res < 0) {
+		ipio_err("Failed to register video device, res = %d\n", res);
+		goto out_unregister;
+	}
+
+	ilitek_v4l2->registered = true;
+	ipio_info("Registered v4l2 touch device %s\n", video_device_node_name(vdev));
+	return 0;
+
+out_unregister:
+	v4l2_device_unregister(&ilitek_v4l2->v4l2);
+out:
+	ilitek_v4l2 = NULL;
+	return res;
+}
+EXPORT_SYMBOL(ilitek_v4l2_init);
+
+void ilitek_v4l2_remove(void)
+{
+	if (ilitek_v4l2 == NULL)
+		return;
+
+	ipio_info("Remove v4l2 touch device\n");
+
+	if (ilitek_v4l2->registered)
+		video_unregister_device(&ilitek_v4l2->vdev);
+
+	v4l2_device_unregister(&ilitek_v4l2->v4l2);
+	ilitek_v4l2 = NULL;
+}
+EXPORT_SYMBOL(ilitek_v4l2_remove);
+
+#endif /* TOUCH_V4L2 */